@@ -9,48 +9,38 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
 
-void LookAndFeel::drawRotarySlider(juce::Graphics& g, int x, int y, int width, int height, float
-    sliderPosProportional, float rotaryStartAngle, float rotaryEndAngle, juce::Slider& slider) {
-    using namespace juce;
+const juce::dsp::FFT& AnalyzerResources::getFFT(FFTOrder order) {
+    const juce::ScopedLock sl(lock);
+    auto& fft = ffts[order - FFTOrder::order1024];
+    if (fft == nullptr)
+        fft = std::make_unique<juce::dsp::FFT>(order);
+    return *fft;
+}
 
-    auto bounds = Rectangle<float>(x, y, width, height);
+const juce::dsp::WindowingFunction<float>& AnalyzerResources::getWindow(FFTOrder order) {
+    const juce::ScopedLock sl(lock);
+    auto& window = windows[order - FFTOrder::order1024];
+    if (window == nullptr)
+        window = std::make_unique<juce::dsp::WindowingFunction<float>>((size_t)1 << order, juce::dsp::WindowingFunction<float>::blackmanHarris);
+    return *window;
+}
 
-    auto enabled = slider.isEnabled();
+void LookAndFeel::drawRotaryBody(juce::Graphics& g, juce::Rectangle<float> bounds, bool enabled) {
+    using namespace juce;
 
     g.setColour(enabled ? Colour(97u, 18u, 167u) : Colours::darkgrey);
     g.fillEllipse(bounds);
 
     g.setColour(enabled ? Colour(255u, 154u, 1u) : Colours::grey);
     g.drawEllipse(bounds, 1.0f);
+}
 
-    if (auto* rswl = dynamic_cast<RotarySliderWithLabels*>(&slider)) {
-        auto center = bounds.getCentre();
-        Path p;
-
-        Rectangle<float> r;
-        r.setLeft(center.getX() - 2);
-        r.setRight(center.getX() + 2);
-        r.setTop(bounds.getY());
-        r.setBottom(center.getY() - rswl->getTextHeight() * 1.5);
-        p.addRoundedRectangle(r, 2.0f);
-        jassert(rotaryStartAngle < rotaryEndAngle);
-        auto sliderAngRad = jmap(sliderPosProportional, 0.0f, 1.0f, rotaryStartAngle, rotaryEndAngle);
-        p.applyTransform(AffineTransform().rotated(sliderAngRad, center.getX(), center.getY()));
-        g.fillPath(p);
-
-        g.setFont(rswl->getTextHeight());
-        auto text = rswl->getDisplayString();
-        auto strWidth = g.getCurrentFont().getStringWidth(text);
-
-        r.setSize(strWidth + 4, rswl->getTextHeight() + 2);
-        r.setCentre(center);
-
-        g.setColour(enabled ? Colours::black : Colours::darkgrey);
-        g.fillRect(r);
+void LookAndFeel::drawRotarySlider(juce::Graphics& g, int x, int y, int width, int height, float
+    sliderPosProportional, float rotaryStartAngle, float rotaryEndAngle, juce::Slider& slider) {
+    using namespace juce;
 
-        g.setColour(enabled ? Colours::white : Colours::lightgrey);
-        g.drawFittedText(text, r.toNearestInt(), juce::Justification::centred, 1);
-    }
+    //RotarySliderWithLabels paints itself from its cached layers, anything else only gets the body
+    drawRotaryBody(g, Rectangle<float>(x, y, width, height), slider.isEnabled());
 }
 
 void LookAndFeel::drawToggleButton(juce::Graphics& g, juce::ToggleButton& toggleButton, bool highlighted, bool down) {
@@ -72,6 +62,16 @@ void LookAndFeel::drawToggleButton(juce::Graphics& g, juce::ToggleButton& toggle
         g.strokePath(powerButton, pst);
         g.drawEllipse(r, 2);
     }
+    else if (auto* viewButton = dynamic_cast<AnalyserViewButton*>(&toggleButton)) {
+        auto colour = !toggleButton.getToggleState() ? Colours::dimgrey : Colour(0u, 172u, 1u);
+
+        g.setColour(colour);
+        auto bounds = toggleButton.getLocalBounds();
+        g.drawRect(bounds);
+
+        g.setFont(12.0f);
+        g.drawFittedText(toggleButton.getButtonText(), bounds, juce::Justification::centred, 1);
+    }
     else if (auto* analyserButton = dynamic_cast<AnalyserButton*>(&toggleButton) ){
         auto colour = !toggleButton.getToggleState() ? Colours::dimgrey : Colour(0u, 172u, 1u);
 
@@ -84,17 +84,40 @@ void LookAndFeel::drawToggleButton(juce::Graphics& g, juce::ToggleButton& toggle
 }
 
 //==============================================================================
+namespace {
+    const float rotaryStartAngle = juce::degreesToRadians(180.0f + 45.0f);
+    const float rotaryEndAngle = juce::degreesToRadians(540.0f - 45.0f);
+}
+
 void RotarySliderWithLabels::paint(juce::Graphics& g) {
     using namespace juce;
 
-    auto startAng = degreesToRadians(180.0f + 45.0f);
-    auto endAng = degreesToRadians(540.0f - 45.0f);
+    auto scale = g.getInternalContext().getPhysicalPixelScaleFactor();
+    bodyLayer.paint(g, getLocalBounds(), scale, [this](Graphics& lg) { drawBody(lg); });
 
+    auto enabled = isEnabled();
     auto range = getRange();
-    auto sliderBounds = getSliderBounds();
+    auto center = getSliderBounds().toFloat().getCentre();
+    auto sliderAngRad = jmap(getValue(), range.getStart(), range.getEnd(), (double)rotaryStartAngle, (double)rotaryEndAngle);
 
-    getLookAndFeel().drawRotarySlider(g, sliderBounds.getX(), sliderBounds.getY(), sliderBounds.getWidth(), sliderBounds.getHeight(), 
-                                      jmap(getValue(), range.getStart(), range.getEnd(), 0.0, 1.0), startAng, endAng, *this);
+    g.setColour(enabled ? Colour(255u, 154u, 1u) : Colours::grey);
+    g.fillPath(pointer, AffineTransform::rotation((float)sliderAngRad, center.getX(), center.getY()));
+
+    if (getValue() != valueTextFor)
+        updateValueText();
+
+    g.setColour(enabled ? Colours::black : Colours::darkgrey);
+    g.fillRect(valueTextBounds);
+
+    g.setColour(enabled ? Colours::white : Colours::lightgrey);
+    valueGlyphs.draw(g);
+}
+
+void RotarySliderWithLabels::drawBody(juce::Graphics& g) {
+    using namespace juce;
+
+    auto sliderBounds = getSliderBounds();
+    LookAndFeel::drawRotaryBody(g, sliderBounds.toFloat(), isEnabled());
 
     auto center = sliderBounds.toFloat().getCentre();
     auto radius = sliderBounds.getWidth() * 0.5f;
@@ -107,7 +130,7 @@ void RotarySliderWithLabels::paint(juce::Graphics& g) {
         auto pos = labels[i].pos;
         jassert(0.0f <= pos);
         jassert(pos <= 1.0f);
-        auto ang = jmap(pos, 0.0f, 1.0f, startAng, endAng);
+        auto ang = jmap(pos, 0.0f, 1.0f, rotaryStartAngle, rotaryEndAngle);
         auto c = center.getPointOnCircumference(radius + getTextHeight() * 0.5f + 1, ang);
 
         Rectangle<float> r;
@@ -119,6 +142,44 @@ void RotarySliderWithLabels::paint(juce::Graphics& g) {
     }
 }
 
+void RotarySliderWithLabels::updateValueText() {
+    valueTextFor = getValue();
+
+    juce::Font font{ juce::FontOptions{ (float)getTextHeight() } };
+    valueGlyphs.clear();
+    valueGlyphs.addLineOfText(font, getDisplayString(), 0.0f, 0.0f);
+
+    auto textBounds = valueGlyphs.getBoundingBox(0, -1, true);
+    valueTextBounds = juce::Rectangle<float>(textBounds.getWidth() + 4, (float)getTextHeight() + 2)
+                          .withCentre(getSliderBounds().toFloat().getCentre());
+    valueGlyphs.moveRangeOfGlyphs(0, -1, valueTextBounds.getCentreX() - textBounds.getCentreX(),
+                                         valueTextBounds.getCentreY() - textBounds.getCentreY());
+}
+
+void RotarySliderWithLabels::resized() {
+    juce::Slider::resized();
+
+    //pointer is built pointing straight up and rotated into place when drawn
+    auto bounds = getSliderBounds().toFloat();
+    auto center = bounds.getCentre();
+
+    juce::Rectangle<float> r;
+    r.setLeft(center.getX() - 2);
+    r.setRight(center.getX() + 2);
+    r.setTop(bounds.getY());
+    r.setBottom(center.getY() - getTextHeight() * 1.5);
+
+    pointer.clear();
+    pointer.addRoundedRectangle(r, 2.0f);
+
+    valueTextFor = std::numeric_limits<double>::quiet_NaN();
+}
+
+void RotarySliderWithLabels::enablementChanged() {
+    juce::Slider::enablementChanged();
+    bodyLayer.invalidate();
+}
+
 juce::Rectangle<int> RotarySliderWithLabels::getSliderBounds() const {
     auto bounds = getLocalBounds();
     auto size = juce::jmin(bounds.getWidth(), bounds.getHeight());
@@ -132,21 +193,16 @@ juce::Rectangle<int> RotarySliderWithLabels::getSliderBounds() const {
 }
 
 juce::String RotarySliderWithLabels::getDisplayString() const {
-    if (auto* choiceParam = dynamic_cast<juce::AudioParameterChoice*>(param))
+    if (choiceParam != nullptr)
         return choiceParam->getCurrentChoiceName();
     juce::String str;
     bool addK = false;
-    if (auto* floatParam = dynamic_cast<juce::AudioParameterFloat*>(param)) {
-        float val = getValue();
-        if (val > 999.0f) {
-            val /= 1000.0f;
-            addK = true;
-        }
-        str = juce::String(val, (addK ? 2 : 0));
-    }
-    else {
-        jassertfalse;
+    float val = getValue();
+    if (val > 999.0f) {
+        val /= 1000.0f;
+        addK = true;
     }
+    str = juce::String(val, (addK ? 2 : 0));
     if (suffix.isNotEmpty()) {
         str << " ";
         if (addK)
@@ -159,49 +215,169 @@ juce::String RotarySliderWithLabels::getDisplayString() const {
 //==============================================================================
 ResponseCurveComponent::ResponseCurveComponent(SimpleEQFromTutorialAudioProcessor& p) : audioProcessor(p), leftPathProducer(audioProcessor.leftChannelFifo),
                                                                                                            rightPathProducer(audioProcessor.rightChannelFifo){
+    addEqualizerBands(engine);
+
+    //the morph blends every band, the analyser switch is read directly and needs no listener
     const auto& params = audioProcessor.getParameters();
-    for (auto param : params)
-        param->addListener(this);
+    parameterBands.assign(params.size(), 0);
+    for (auto param : params) {
+        auto* withID = dynamic_cast<juce::AudioProcessorParameterWithID*>(param);
+        if (withID == nullptr)
+            continue;
+
+        const auto& id = withID->getParameterID();
+        juce::uint32 bands = 0;
+        if (id.startsWith("LowCut")) bands = 1u << LowCutBand;
+        else if (id.startsWith("HighCut")) bands = 1u << HighCutBand;
+        else if (id.startsWith("Morph")) bands = AllBands;
+        else {
+            if (id == "Peak Count")
+                bands = AllPeakBands;
+            for (int peak = 0; peak < MaxPeakBands; ++peak)
+                if (id.startsWith(getPeakParameterPrefix(peak)))
+                    bands = 1u << (FirstPeakBand + peak);
+        }
 
-    updateChain();
+        if (bands != 0) {
+            parameterBands[param->getParameterIndex()] = bands;
+            param->addListener(this);
+        }
+    }
 
-    startTimerHz(60);
+    analyserEnabled = audioProcessor.apvts.getRawParameterValue("Analyser Enabled");
+    analyserAveraging = &audioProcessor.analyserAveragingMs;
+    analyserDecay = &audioProcessor.analyserDecayDbPerSecond;
+    analyserPeakHold = &audioProcessor.analyserPeakHoldMs;
+    audioProcessor.analyzerConsumerActive.store(true);
+
+    //no design pass here, the first updateResponseCurve() sees a new sample rate and runs updateChain()
 }
 
 ResponseCurveComponent::~ResponseCurveComponent() {
+    waitForAnalysis();
+
     const auto& params = audioProcessor.getParameters();
     for (auto param : params)
         param->removeListener(this);
+
+    audioProcessor.preEQTapEnabled.store(false);
+    audioProcessor.analyzerConsumerActive.store(false);
 }
 
-void ResponseCurveComponent::parameterValueChanged(int parmeterIndex, float newValue) {
-    parametersChanged.set(true);
+void ResponseCurveComponent::setAnalyserViews(bool showPreEQ, bool showDelta) {
+    showPreEQAnalysis = showPreEQ;
+    showDeltaAnalysis = showDelta;
+    waitForAnalysis();
+    leftPathProducer.setViews(showPreEQ, showDelta);
+    rightPathProducer.setViews(showPreEQ, showDelta);
+    updatePreEQTap();
+    idleFrames = 0;
+    repaint();
+}
+
+void ResponseCurveComponent::updatePreEQTap() {
+    audioProcessor.preEQTapEnabled.store(showPreEQAnalysis || showDeltaAnalysis || matchCaptureEnabled);
+}
+
+void ResponseCurveComponent::setMatchCaptureEnabled(bool shouldCapture) {
+    waitForAnalysis();
+    if (shouldCapture && !matchCaptureEnabled) {
+        auto sampleRate = audioProcessor.getSampleRate();
+        for (auto& analyser : matchCapture)
+            analyser.prepare(sampleRate > 0.0 ? sampleRate : 48000.0);
+    }
+    matchCaptureEnabled = shouldCapture;
+    leftPathProducer.setCapture(shouldCapture ? &matchCapture[0] : nullptr);
+    rightPathProducer.setCapture(shouldCapture ? &matchCapture[1] : nullptr);
+    updatePreEQTap();
 }
 
-void PathProducer::process(juce::Rectangle<float> fftBounds, double sampleRate) {
-    juce::AudioBuffer<float> tempIncomingBuffer;
+AverageSpectrum ResponseCurveComponent::getCapturedInput() {
+    waitForAnalysis();
+    auto spectrum = matchCapture[0].getSpectrum();
+    spectrum.merge(matchCapture[1].getSpectrum());
+    return spectrum;
+}
+
+void ResponseCurveComponent::parameterValueChanged(int parameterIndex, float newValue) {
+    if (juce::isPositiveAndBelow(parameterIndex, (int)parameterBands.size()))
+        dirtyBands.fetch_or(parameterBands[parameterIndex], std::memory_order_relaxed);
+}
+
+bool PathProducer::process(juce::Rectangle<float> fftBounds, double sampleRate) {
+    SIMPLEEQ_TRACE_SCOPE("PathProducer::process");
+    auto numColumns = (int)fftBounds.getWidth();
+    if (numColumns <= 0 || sampleRate <= 0.0)
+        return false;
+
+    if (sampleRate != leftChannelFFTDataGenerator.getSampleRate()) {
+        leftChannelFFTDataGenerator.prepare(sampleRate, FFTOrder::order1024);
+        columnSpans.clear();
+    }
+
+    if (numColumns != (int)columnSpans.size()) {
+        updateColumnMapping(numColumns);
+        ballistics.prepare(numColumns, leftChannelFFTDataGenerator.NegativeInfinity);
+        preEQBallistics.prepare(numColumns, leftChannelFFTDataGenerator.NegativeInfinity);
+    }
 
-    while (leftChannelFifo->getNumCompleteBuffersAvailable() > 0) {
-        if (leftChannelFifo->getAudioBuffer(tempIncomingBuffer)) {
-            auto size = tempIncomingBuffer.getNumSamples();
-            juce::FloatVectorOperations::copy(monoBuffer.getWritePointer(0, 0), monoBuffer.getReadPointer(0, size), monoBuffer.getNumSamples() - size);
-            juce::FloatVectorOperations::copy(monoBuffer.getWritePointer(0, monoBuffer.getNumSamples() - size), tempIncomingBuffer.getReadPointer(0, 0), size);
-            leftChannelFFTDataGenerator.produceFFTDataForRendering(monoBuffer, -48.0f);
+    const bool tapPreEQ = preEQViewEnabled || deltaViewEnabled;
+    leftChannelFFTDataGenerator.setPreEQTapEnabled(tapPreEQ);
+
+    /* while there are audio buffers to pull
+        feed them to the analyzer levels
+            every time the top level completes a frame, stitch the levels into columns
+            and fold that into the ballistics
+       then generate one path from the result */
+    bool gotFrame = false;
+
+    while (leftChannelFifo->getAudioBuffer(incomingBuffer)) {
+        //a prepareToPlay dropped what was queued, don't stitch the old stream onto the new one
+        if (leftChannelFifo->reconfigured())
+            leftChannelFFTDataGenerator.reset();
+
+        auto* samples = incomingBuffer.getReadPointer(AnalyzerTap::PostEQ);
+        auto* preEQSamples = incomingBuffer.getReadPointer(AnalyzerTap::PreEQ);
+        auto size = incomingBuffer.getNumSamples();
+        if (capture != nullptr)
+            capture->push(preEQSamples, size);
+
+        for (int pos = 0; pos < size; ) {
+            auto num = leftChannelFFTDataGenerator.pushSamples(samples + pos, preEQSamples + pos, size - pos);
+            pos += num;
+
+            if (leftChannelFFTDataGenerator.pullFrame()) {
+                auto frameSeconds = leftChannelFFTDataGenerator.getFrameSeconds();
+                mapBinsToColumns(AnalyzerTap::PostEQ);
+                ballistics.process(columnData.data(), numColumns, frameSeconds);
+                if (tapPreEQ) {
+                    mapBinsToColumns(AnalyzerTap::PreEQ);
+                    preEQBallistics.process(columnData.data(), numColumns, frameSeconds);
+                }
+                gotFrame = true;
+            }
         }
     }
-    /* if there are FFT data buffers to pull
-        if we can pull a buffer
-            generate a path */
-    auto fftSize = leftChannelFFTDataGenerator.getFFTSize();
-    const auto binWidth = sampleRate / (double)fftSize;
 
-    while (leftChannelFFTDataGenerator.getNumAvailableFFTDataBlocks() > 0) {
-        std::vector<float> fftData;
-        if (leftChannelFFTDataGenerator.getFFTData(fftData)) {
-            pathProducer.generatePath(fftData, fftBounds, fftSize, binWidth, -48.0f);
+    if (gotFrame) {
+        pathProducer.generatePath(ballistics.getDisplay(), fftBounds, leftChannelFFTDataGenerator.NegativeInfinity);
+        peakPathProducer.generatePath(ballistics.getPeaks(), fftBounds, leftChannelFFTDataGenerator.NegativeInfinity);
+
+        if (preEQViewEnabled)
+            preEQPathProducer.generatePath(preEQBallistics.getDisplay(), fftBounds, leftChannelFFTDataGenerator.NegativeInfinity);
+
+        if (deltaViewEnabled) {
+            //drawn on the same -24..24 dB scale as the response curve so the two can be compared
+            deltaData.resize(numColumns);
+            juce::FloatVectorOperations::subtract(deltaData.data(), ballistics.getDisplay().data(), preEQBallistics.getDisplay().data(), numColumns);
+            deltaPathProducer.generatePath(deltaData, -24.0f, 24.0f, fftBounds.getHeight(), 0.0f);
         }
     }
 
+    return gotFrame;
+}
+
+void PathProducer::collectPaths() {
     /*
     while there ar paths that can be pulled
         pull as many as we can
@@ -210,137 +386,364 @@ void PathProducer::process(juce::Rectangle<float> fftBounds, double sampleRate)
     while (pathProducer.getNumPathsAvailable()) {
         pathProducer.getPath(leftChannelFFTPath);
     }
+    while (peakPathProducer.getNumPathsAvailable()) {
+        peakPathProducer.getPath(leftChannelPeakPath);
+    }
+    while (preEQPathProducer.getNumPathsAvailable()) {
+        preEQPathProducer.getPath(leftChannelPreEQPath);
+    }
+    while (deltaPathProducer.getNumPathsAvailable()) {
+        deltaPathProducer.getPath(leftChannelDeltaPath);
+    }
 }
 
-void ResponseCurveComponent::timerCallback() {
-    if (shouldShowFFTAnalysis) {
-        auto fftBounds = getAnalArea().toFloat();
-        auto sampleRate = audioProcessor.getSampleRate();
-        leftPathProducer.process(fftBounds, sampleRate);
-        rightPathProducer.process(fftBounds, sampleRate);
+void PathProducer::restart() {
+    leftChannelFifo->discardPendingBuffers();
+    leftChannelFFTDataGenerator.reset();
+    columnSpans.clear(); //remaps the columns and restarts the ballistics on the next process()
+    leftChannelFFTPath.clear();
+    leftChannelPeakPath.clear();
+    leftChannelPreEQPath.clear();
+    leftChannelDeltaPath.clear();
+}
+
+void PathProducer::setViews(bool showPreEQ, bool showDelta) {
+    if (showPreEQ && !preEQViewEnabled)
+        leftChannelPreEQPath.clear();
+    if (showDelta && !deltaViewEnabled)
+        leftChannelDeltaPath.clear();
+
+    //restart the pre-EQ ballistics so a stale curve doesn't fade in
+    if ((showPreEQ || showDelta) && !(preEQViewEnabled || deltaViewEnabled) && !columnSpans.empty())
+        preEQBallistics.prepare((int)columnSpans.size(), leftChannelFFTDataGenerator.NegativeInfinity);
+
+    preEQViewEnabled = showPreEQ;
+    deltaViewEnabled = showDelta;
+}
+
+void PathProducer::updateColumnMapping(int numColumns) {
+    const auto& analyzer = leftChannelFFTDataGenerator;
+    const auto lastBin = analyzer.getNumBins() - 1;
+
+    columnSpans.resize(numColumns);
+    columnData.assign(numColumns, analyzer.NegativeInfinity);
+
+    for (int x = 0; x < numColumns; ++x) {
+        auto lowFreq = juce::mapToLog10(double(x) / numColumns, 20.0, 20000.0);
+        auto highFreq = juce::mapToLog10(double(x + 1) / numColumns, 20.0, 20000.0);
+
+        //the whole column reads from the level that owns its centre frequency
+        ColumnSpan span;
+        span.level = analyzer.getLevelForFrequency(std::sqrt(lowFreq * highFreq));
+        auto binWidth = analyzer.getBinWidth(span.level);
+        auto lowBin = lowFreq / binWidth;
+        auto highBin = highFreq / binWidth;
+
+        span.firstBin = juce::jlimit(0, lastBin, (int)std::ceil(lowBin));
+        span.lastBin = juce::jlimit(0, lastBin, (int)std::floor(highBin));
+        span.frac = 0.0f;
+
+        if (span.lastBin < span.firstBin) {
+            //no bin centre lands in this column, interpolate instead
+            span.firstBin = juce::jlimit(0, lastBin - 1, (int)std::floor(lowBin));
+            span.lastBin = span.firstBin - 1;
+            span.frac = juce::jlimit(0.0f, 1.0f, float(lowBin - span.firstBin));
+        }
+        columnSpans[x] = span;
     }
+}
 
-    if (parametersChanged.compareAndSetBool(false, true))
-        updateChain();
+void PathProducer::mapBinsToColumns(AnalyzerTap tap) {
+    for (size_t x = 0; x < columnSpans.size(); ++x) {
+        const auto& span = columnSpans[x];
+        const auto& binData = leftChannelFFTDataGenerator.getSpectrum(span.level, tap);
+        if (span.lastBin < span.firstBin) {
+            auto a = binData[span.firstBin];
+            columnData[x] = a + span.frac * (binData[span.firstBin + 1] - a);
+        }
+        else {
+            columnData[x] = *std::max_element(binData.begin() + span.firstBin, binData.begin() + span.lastBin + 1);
+        }
+    }
+}
 
-    repaint();
+juce::ThreadPoolJob::JobStatus ResponseCurveComponent::AnalysisJob::runJob() {
+    //both channels have to be processed, so no short circuiting here
+    auto left = owner.leftPathProducer.process(owner.analysisBounds, owner.analysisSampleRate);
+    auto right = owner.rightPathProducer.process(owner.analysisBounds, owner.analysisSampleRate);
+    owner.analysisGotFrame = left || right;
+    return jobHasFinished;
 }
 
-void ResponseCurveComponent::updateChain() {
-    auto chainSettings = getChainSettings(audioProcessor.apvts);
+void ResponseCurveComponent::waitForAnalysis() {
+    analyzerResources->getPool().waitForJobToFinish(&analysisJob, -1);
+}
+
+void ResponseCurveComponent::analyzerFrame() {
+    if (!isShowing())
+        return;
+
+    //once nothing has changed for a while only look every few frames
+    if (idleFrames >= IdleAfterFrames && ++idleSkip % IdlePollDivider != 0)
+        return;
+
+    bool needsRepaint = false;
+
+    //read the parameter rather than the button so host automation and state recall are followed too
+    auto analyserOn = analyserEnabled->load() > 0.5f;
+    if (analyserOn != shouldShowFFTAnalysis) {
+        if (analyserOn) {
+            waitForAnalysis();
+            leftPathProducer.restart();
+            rightPathProducer.restart();
+            analysisGotFrame = false;
+        }
+        needsRepaint = true;
+    }
+    shouldShowFFTAnalysis = analyserOn;
+
+    //pick up what the last job produced and queue the next one. a job that's still running just means
+    //this editor skips a frame
+    auto& pool = analyzerResources->getPool();
+    if ((shouldShowFFTAnalysis || matchCaptureEnabled) && !pool.contains(&analysisJob)) {
+        if (analysisGotFrame) {
+            leftPathProducer.collectPaths();
+            rightPathProducer.collectPaths();
+            analysisGotFrame = false;
+            needsRepaint = true;
+        }
+        updateBallistics();
+        analysisBounds = getAnalArea().toFloat();
+        analysisSampleRate = audioProcessor.getSampleRate();
+        pool.addJob(&analysisJob, false);
+    }
+
+    if (auto bands = dirtyBands.exchange(0, std::memory_order_relaxed))
+        updateChain(bands);
+
+    needsRepaint |= updateResponseCurve();
+
+    if (needsRepaint) {
+        repaint();
+        idleFrames = 0;
+    }
+    else if (idleFrames < IdleAfterFrames) {
+        ++idleFrames;
+    }
+}
+
+//only called while the pool doesn't hold the job, so the producers are the message thread's
+void ResponseCurveComponent::updateBallistics() {
+    auto settings = appliedBallistics;
+    settings.averagingMs = analyserAveraging->load();
+    settings.decayDbPerSecond = analyserDecay->load();
+    settings.peakHoldMs = analyserPeakHold->load();
+    if (settings.averagingMs == appliedBallistics.averagingMs && settings.decayDbPerSecond == appliedBallistics.decayDbPerSecond
+        && settings.peakHoldMs == appliedBallistics.peakHoldMs)
+        return;
+
+    leftPathProducer.setBallistics(settings);
+    rightPathProducer.setBallistics(settings);
+    appliedBallistics = settings;
+}
+
+void ResponseCurveComponent::updateChain(juce::uint32 bands) {
+    chainSettings = audioProcessor.getEffectiveChainSettings();
     auto sampleRate = audioProcessor.getSampleRate();
-    monoChain.setBypassed<ChainPositions::LowCut>(chainSettings.lowCutBypass);
-    monoChain.setBypassed<ChainPositions::HighCut>(chainSettings.highCutBypass);
-    monoChain.setBypassed<ChainPositions::Peak1>(chainSettings.peak1Bypass);
-    monoChain.setBypassed<ChainPositions::Peak2>(chainSettings.peak2Bypass);
-    monoChain.setBypassed<ChainPositions::Peak3>(chainSettings.peak3Bypass);
-
-    auto lowCutCoefficients = makeLowCutFilter(chainSettings, sampleRate);
-    auto highCutCoefficients = makeHighCutFilter(chainSettings, sampleRate);
-    auto peak1Coefficients = makePeak1Filter(chainSettings, sampleRate);
-    auto peak2Coefficients = makePeak2Filter(chainSettings, sampleRate);
-    auto peak3Coefficients = makePeak3Filter(chainSettings, sampleRate);
-    updateCutFilter(monoChain.get<ChainPositions::LowCut>(), lowCutCoefficients, chainSettings.lowCutSlope);
-    updateCutFilter(monoChain.get<ChainPositions::HighCut>(), highCutCoefficients, chainSettings.highCutSlope);
-    updateCoefficients(monoChain.get<ChainPositions::Peak1>().coefficients, peak1Coefficients);
-    updateCoefficients(monoChain.get<ChainPositions::Peak2>().coefficients, peak2Coefficients);
-    updateCoefficients(monoChain.get<ChainPositions::Peak3>().coefficients, peak3Coefficients);
+    if (sampleRate > 0.0 && sampleRate != engine.getSampleRate()) {
+        engine.prepare(sampleRate);
+        bands = AllBands;
+    }
+
+    for (int band = 0; band < NumBands; ++band)
+        if ((bands & (1u << band)) != 0)
+            applyBandSettings(engine, chainSettings, band);
+
+    pendingCurveBands |= bands;
 }
 
-void ResponseCurveComponent::paint(juce::Graphics& g)
-{
-    using namespace juce;
-    g.fillAll(Colours::black);
+ResponseCurveComponent::BandSnapshot ResponseCurveComponent::getBandSnapshot(const ChainSettings& settings, int band) {
+    BandSnapshot snapshot;
+    if (band == LowCutBand) {
+        snapshot.freq = settings.lowCutFreq;
+        snapshot.slope = settings.lowCutSlope;
+        snapshot.bypassed = settings.lowCutBypass;
+    }
+    else if (band == HighCutBand) {
+        snapshot.freq = settings.highCutFreq;
+        snapshot.slope = settings.highCutSlope;
+        snapshot.bypassed = settings.highCutBypass;
+    }
+    else {
+        const auto& peak = settings.peaks[band - FirstPeakBand];
+        snapshot.freq = peak.freq;
+        snapshot.gainInDecibels = peak.gainInDecibels;
+        snapshot.quality = peak.quality;
+        snapshot.bypassed = !settings.isPeakActive(band - FirstPeakBand);
+    }
+    return snapshot;
+}
 
-    g.drawImage(background, getLocalBounds().toFloat());
+void ResponseCurveComponent::updateBandMagnitudes(int band) {
+    auto& mags = bandMagnitudes[band];
 
-    auto responseArea = getAnalArea();
+    if (bandSnapshots[band].bypassed) {
+        std::fill(mags.begin(), mags.end(), 0.0f);
+        return;
+    }
 
+    std::array<BiquadCoefficients, BandEngine::MaxCutSections> sections;
+    auto numSections = engine.getActiveSections(band, sections.data());
+    magnitudeEvaluator.evaluate(sections.data(), numSections, mags.data());
+}
+
+bool ResponseCurveComponent::updateResponseCurve() {
+    using namespace juce;
+    auto responseArea = getAnalArea();
     auto w = responseArea.getWidth();
+    auto sampleRate = audioProcessor.getSampleRate();
 
-    auto& lowCut = monoChain.get<ChainPositions::LowCut>();
-    auto& peak1 = monoChain.get<ChainPositions::Peak1>();
-    auto& peak2 = monoChain.get<ChainPositions::Peak2>();
-    auto& peak3 = monoChain.get<ChainPositions::Peak3>();
-    auto& highCut = monoChain.get<ChainPositions::HighCut>();
+    if (w <= 0 || sampleRate <= 0.0)
+        return false;
 
-    auto sampleRate = audioProcessor.getSampleRate();
+    bool allDirty = false;
+    if (w != magnitudeEvaluator.getNumPoints() || sampleRate != cachedSampleRate) {
+        //coefficients depend on the sample rate too
+        if (sampleRate != cachedSampleRate)
+            updateChain(AllBands);
 
-    std::vector<double> mags;
-
-    mags.resize(w);
-
-    for (int i = 0; i < w; ++i) {
-        double mag = 1.0f;
-        auto freq = mapToLog10(double(i) / double(w), 20.0, 20000.0);
-
-        if (!monoChain.isBypassed<ChainPositions::Peak1>())
-            mag *= peak1.coefficients->getMagnitudeForFrequency(freq, sampleRate);
-        if (!monoChain.isBypassed<ChainPositions::Peak2>())
-            mag *= peak2.coefficients->getMagnitudeForFrequency(freq, sampleRate);
-        if (!monoChain.isBypassed<ChainPositions::Peak3>())
-            mag *= peak3.coefficients->getMagnitudeForFrequency(freq, sampleRate);
-        if (!monoChain.isBypassed<ChainPositions::LowCut>()) {
-            if (!lowCut.isBypassed<0>())
-                mag *= lowCut.get<0>().coefficients->getMagnitudeForFrequency(freq, sampleRate);
-            if (!lowCut.isBypassed<1>())
-                mag *= lowCut.get<1>().coefficients->getMagnitudeForFrequency(freq, sampleRate);
-            if (!lowCut.isBypassed<2>())
-                mag *= lowCut.get<2>().coefficients->getMagnitudeForFrequency(freq, sampleRate);
-            if (!lowCut.isBypassed<3>())
-                mag *= lowCut.get<3>().coefficients->getMagnitudeForFrequency(freq, sampleRate);
-        }
-        if (!monoChain.isBypassed<ChainPositions::HighCut>()) {
-            if (!highCut.isBypassed<0>())
-                mag *= highCut.get<0>().coefficients->getMagnitudeForFrequency(freq, sampleRate);
-            if (!highCut.isBypassed<1>())
-                mag *= highCut.get<1>().coefficients->getMagnitudeForFrequency(freq, sampleRate);
-            if (!highCut.isBypassed<2>())
-                mag *= highCut.get<2>().coefficients->getMagnitudeForFrequency(freq, sampleRate);
-            if (!highCut.isBypassed<3>())
-                mag *= highCut.get<3>().coefficients->getMagnitudeForFrequency(freq, sampleRate);
+        magnitudeEvaluator.prepare(w, sampleRate);
+
+        for (auto& mags : bandMagnitudes)
+            mags.assign(w, 0.0f);
+        totalMagnitudes.assign(w, 0.0f);
+
+        cachedSampleRate = sampleRate;
+        allDirty = true;
+    }
+
+    //chainSettings can be newer than the coefficients of bands that weren't rebuilt yet, so only rebuilt
+    //bands are compared. the rest get their turn once their dirty bit is drained
+    bool anyChanged = allDirty || responseArea != cachedResponseArea;
+    for (int band = 0; band < NumBands; ++band) {
+        if (!allDirty && (pendingCurveBands & (1u << band)) == 0)
+            continue;
+
+        auto snapshot = getBandSnapshot(chainSettings, band);
+        if (allDirty || !(snapshot == bandSnapshots[band])) {
+            bandSnapshots[band] = snapshot;
+            updateBandMagnitudes(band);
+            anyChanged = true;
         }
-        mags[i] = Decibels::gainToDecibels(mag);
     }
+    pendingCurveBands = 0;
+
+    if (!anyChanged)
+        return false;
 
-    Path responseCurve;
+    //bands are in dB, so the cascade is just their sum
+    FloatVectorOperations::copy(totalMagnitudes.data(), bandMagnitudes[0].data(), w);
+    for (int band = 1; band < NumBands; ++band)
+        FloatVectorOperations::add(totalMagnitudes.data(), bandMagnitudes[band].data(), w);
 
-    const double outputMin = responseArea.getBottom();
-    const double outputMax = responseArea.getY();
-    auto map = [outputMin, outputMax](double input) {
-        return jmap(input, -24.0, 24.0, outputMin, outputMax);
+    const float outputMin = responseArea.getBottom();
+    const float outputMax = responseArea.getY();
+    auto map = [outputMin, outputMax](float input) {
+        return jmap(input, -24.0f, 24.0f, outputMin, outputMax);
         };
 
-    responseCurve.startNewSubPath(responseArea.getX(), map(mags.front()));
+    responseCurve.clear();
+    responseCurve.preallocateSpace(3 * w);
+    responseCurve.startNewSubPath(responseArea.getX(), map(totalMagnitudes.front()));
+
+    for (int i = 1; i < w; ++i)
+        responseCurve.lineTo(responseArea.getX() + i, map(totalMagnitudes[i]));
+
+    cachedResponseArea = responseArea;
+    responseCurveLayer.invalidate();
+    return true;
+}
+
+void ResponseCurveComponent::paint(juce::Graphics& g)
+{
+    SIMPLEEQ_TRACE_SCOPE("ResponseCurveComponent::paint");
+    using namespace juce;
 
-    for (size_t i = 1; i < mags.size(); ++i)
-        responseCurve.lineTo(responseArea.getX() + i, map(mags[i]));
+    //a typical frame is two blits and the live analyzer strokes in between
+    const auto bounds = getLocalBounds();
+    const auto scale = g.getInternalContext().getPhysicalPixelScaleFactor();
+
+    gridLayer.paint(g, bounds, scale, [this](Graphics& lg) { drawBackgroundGrid(lg); });
+
+    auto responseArea = getAnalArea();
 
     if (shouldShowFFTAnalysis) {
+        auto translation = AffineTransform().translation(responseArea.getX(), responseArea.getY());
+
+        if (showPreEQAnalysis) {
+            auto leftChannelPreEQPath = leftPathProducer.getPreEQPath();
+            leftChannelPreEQPath.applyTransform(translation);
+            g.setColour(Colours::slategrey);
+            g.strokePath(leftChannelPreEQPath, PathStrokeType(1.0f));
+
+            auto rightChannelPreEQPath = rightPathProducer.getPreEQPath();
+            rightChannelPreEQPath.applyTransform(translation);
+            g.setColour(Colours::rosybrown);
+            g.strokePath(rightChannelPreEQPath, PathStrokeType(1.0f));
+        }
+
+        auto leftChannelPeakPath = leftPathProducer.getPeakPath();
+        leftChannelPeakPath.applyTransform(translation);
+        g.setColour(Colours::skyblue.withAlpha(0.4f));
+        g.strokePath(leftChannelPeakPath, PathStrokeType(1.0f));
+
+        auto rightChannelPeakPath = rightPathProducer.getPeakPath();
+        rightChannelPeakPath.applyTransform(translation);
+        g.setColour(Colours::lightyellow.withAlpha(0.4f));
+        g.strokePath(rightChannelPeakPath, PathStrokeType(1.0f));
+
         auto leftChannelFFTPath = leftPathProducer.getPath();
-        leftChannelFFTPath.applyTransform(AffineTransform().translation(responseArea.getX(), responseArea.getY()));
+        leftChannelFFTPath.applyTransform(translation);
 
         g.setColour(Colours::skyblue);
         g.strokePath(leftChannelFFTPath, PathStrokeType(1.0f));
 
         auto rightChannelFFTPath = rightPathProducer.getPath();
-        rightChannelFFTPath.applyTransform(AffineTransform().translation(responseArea.getX(), responseArea.getY()));
+        rightChannelFFTPath.applyTransform(translation);
 
         g.setColour(Colours::lightyellow);
         g.strokePath(rightChannelFFTPath, PathStrokeType(1.0f));
+
+        if (showDeltaAnalysis) {
+            auto leftChannelDeltaPath = leftPathProducer.getDeltaPath();
+            leftChannelDeltaPath.applyTransform(translation);
+            g.setColour(Colours::deepskyblue);
+            g.strokePath(leftChannelDeltaPath, PathStrokeType(1.5f));
+
+            auto rightChannelDeltaPath = rightPathProducer.getDeltaPath();
+            rightChannelDeltaPath.applyTransform(translation);
+            g.setColour(Colours::gold);
+            g.strokePath(rightChannelDeltaPath, PathStrokeType(1.5f));
+        }
     }
 
-    g.setColour(Colours::orange);
-    g.drawRoundedRectangle(getRenderArea().toFloat(), 4.0f, 1.0f);
+    responseCurveLayer.paint(g, bounds, scale, [this](Graphics& lg) {
+        lg.setColour(Colours::orange);
+        lg.drawRoundedRectangle(getRenderArea().toFloat(), 4.0f, 1.0f);
 
-    g.setColour(Colours::white);
-    g.strokePath(responseCurve, PathStrokeType(2.0f));
+        lg.setColour(Colours::white);
+        lg.strokePath(responseCurve, PathStrokeType(2.0f));
+    });
 }
 
 void ResponseCurveComponent::resized() {
+    //the layers notice the new size themselves the next time they're painted
+    updateResponseCurve();
+}
+
+void ResponseCurveComponent::drawBackgroundGrid(juce::Graphics& g) {
     using namespace juce;
-    background = Image(Image::PixelFormat::RGB, getWidth(), getHeight(), true);
-    Graphics g(background);
+    g.fillAll(Colours::black);
 
     Array<float> freqs{ 20, /*30, 40,*/ 50, 100, 200, /*300, 400,*/ 500, 1000, 2000, /*3000, 4000,*/ 5000, 10000, 20000 };
 
@@ -444,15 +847,6 @@ juce::Rectangle<int> ResponseCurveComponent::getAnalArea() {
 //==============================================================================
 SimpleEQFromTutorialAudioProcessorEditor::SimpleEQFromTutorialAudioProcessorEditor(SimpleEQFromTutorialAudioProcessor& p)
     : AudioProcessorEditor(&p), audioProcessor(p),
-    peak1FreqSlider(*audioProcessor.apvts.getParameter("Peak 1 Freq"), "Hz"),
-    peak2FreqSlider(*audioProcessor.apvts.getParameter("Peak 2 Freq"), "Hz"),
-    peak3FreqSlider(*audioProcessor.apvts.getParameter("Peak 3 Freq"), "Hz"),
-    peak1GainSlider(*audioProcessor.apvts.getParameter("Peak 1 Gain"), "dB"),
-    peak2GainSlider(*audioProcessor.apvts.getParameter("Peak 2 Gain"), "dB"),
-    peak3GainSlider(*audioProcessor.apvts.getParameter("Peak 3 Gain"), "dB"),
-    peak1QualitySlider(*audioProcessor.apvts.getParameter("Peak 1 Quality"), ""),
-    peak2QualitySlider(*audioProcessor.apvts.getParameter("Peak 2 Quality"), ""),
-    peak3QualitySlider(*audioProcessor.apvts.getParameter("Peak 3 Quality"), ""),
     lowCutSlopeSlider(*audioProcessor.apvts.getParameter("LowCut Slope"), "dB/Oct"),
     highCutSlopeSlider(*audioProcessor.apvts.getParameter("HighCut Slope"), "dB/Oct"),
     lowCutFreqSlider(*audioProcessor.apvts.getParameter("LowCut Freq"), "Hz"),
@@ -460,91 +854,75 @@ SimpleEQFromTutorialAudioProcessorEditor::SimpleEQFromTutorialAudioProcessorEdit
 
     responseCurveComponent(audioProcessor),
 
-    peak1FreqSliderAttachment(audioProcessor.apvts, "Peak 1 Freq", peak1FreqSlider),
-    peak1GainSliderAttachment(audioProcessor.apvts, "Peak 1 Gain", peak1GainSlider),
-    peak1QualitySliderAttachment(audioProcessor.apvts, "Peak 1 Quality", peak1QualitySlider),
-    peak2FreqSliderAttachment(audioProcessor.apvts, "Peak 2 Freq", peak2FreqSlider),
-    peak2GainSliderAttachment(audioProcessor.apvts, "Peak 2 Gain", peak2GainSlider),
-    peak2QualitySliderAttachment(audioProcessor.apvts, "Peak 2 Quality", peak2QualitySlider),
-    peak3FreqSliderAttachment(audioProcessor.apvts, "Peak 3 Freq", peak3FreqSlider),
-    peak3GainSliderAttachment(audioProcessor.apvts, "Peak 3 Gain", peak3GainSlider),
-    peak3QualitySliderAttachment(audioProcessor.apvts, "Peak 3 Quality", peak3QualitySlider),
     lowCutFreqSliderAttachment(audioProcessor.apvts, "LowCut Freq", lowCutFreqSlider),
     highCutFreqSliderAttachment(audioProcessor.apvts, "HighCut Freq", highCutFreqSlider),
     lowCutSlopeSliderAttachment(audioProcessor.apvts, "LowCut Slope", lowCutSlopeSlider),
     highCutSlopeSliderAttachment(audioProcessor.apvts, "HighCut Slope", highCutSlopeSlider),
     lowCutBypassButtonAttachment(audioProcessor.apvts, "LowCut Bypass", lowCutBypassButton),
     highCutBypassButtonAttachment(audioProcessor.apvts, "HighCut Bypass", highCutBypassButton),
-    peak1BypassButtonAttachment(audioProcessor.apvts, "Peak 1 Bypass", peak1BypassButton),
-    peak2BypassButtonAttachment(audioProcessor.apvts, "Peak 2 Bypass", peak2BypassButton),
-    peak3BypassButtonAttachment(audioProcessor.apvts, "Peak 3 Bypass", peak3BypassButton),
-    analyserEnabledButtonAttachment(audioProcessor.apvts, "Analyzer Enabled", analyserEnabledButton)
+    analyserEnabledButtonAttachment(audioProcessor.apvts, "Analyser Enabled", analyserEnabledButton),
+    morphEnabledButtonAttachment(audioProcessor.apvts, "Morph Enabled", morphEnabledButton),
+    autoGainButtonAttachment(audioProcessor.apvts, "Auto Gain", autoGainButton),
+    morphSliderAttachment(audioProcessor.apvts, "Morph", morphSlider),
+    peakCountSliderAttachment(audioProcessor.apvts, "Peak Count", peakCountSlider)
 {
-    peak1FreqSlider.labels.add({ 0.0f, "20Hz"});
-    peak1FreqSlider.labels.add({ 1.0f, "20khz" });
-    peak1GainSlider.labels.add({ 0.0f, "-24dB" });
-    peak1GainSlider.labels.add({ 1.0f, "24dB" });
-    peak1QualitySlider.labels.add({ 0.0f, "0.1" });
-    peak1QualitySlider.labels.add({ 1.0f, "10.0" });
-    peak2FreqSlider.labels.add({ 0.0f, "20Hz" });
-    peak2FreqSlider.labels.add({ 1.0f, "20khz" });
-    peak2GainSlider.labels.add({ 0.0f, "-24dB" });
-    peak2GainSlider.labels.add({ 1.0f, "24dB" });
-    peak2QualitySlider.labels.add({ 0.0f, "0.1" });
-    peak2QualitySlider.labels.add({ 1.0f, "10.0" });
-    peak3FreqSlider.labels.add({ 0.0f, "20Hz" });
-    peak3FreqSlider.labels.add({ 1.0f, "20khz" });
-    peak3GainSlider.labels.add({ 0.0f, "-24dB" });
-    peak3GainSlider.labels.add({ 1.0f, "24dB" });
-    peak3QualitySlider.labels.add({ 0.0f, "0.1" });
-    peak3QualitySlider.labels.add({ 1.0f, "10.0" });
     lowCutFreqSlider.labels.add({ 0.0f, "20Hz" });
     lowCutFreqSlider.labels.add({ 1.0f, "20khz" });
     lowCutSlopeSlider.labels.add({ 0.0f, "12" });
-    lowCutSlopeSlider.labels.add({ 1.0f, "48" });
+    lowCutSlopeSlider.labels.add({ 1.0f, "96" });
     highCutFreqSlider.labels.add({ 0.0f, "20Hz" });
     highCutFreqSlider.labels.add({ 1.0f, "20khz" });
     highCutSlopeSlider.labels.add({ 0.0f, "12" });
-    highCutSlopeSlider.labels.add({ 1.0f, "48" });
+    highCutSlopeSlider.labels.add({ 1.0f, "96" });
     
+    //not parameters, the bars read and write the processor's display settings directly
+    auto setUpBallisticsSlider = [](juce::Slider& slider, std::atomic<float>& setting, juce::NormalisableRange<double> range,
+                                    std::function<juce::String(double)> text) {
+        slider.setNormalisableRange(range);
+        slider.textFromValueFunction = std::move(text);
+        slider.setValue(setting.load(), juce::dontSendNotification);
+        slider.updateText();
+        slider.onValueChange = [&slider, &setting] { setting.store((float)slider.getValue()); };
+    };
+    setUpBallisticsSlider(analyserAveragingSlider, audioProcessor.analyserAveragingMs, { 0.0, 2000.0, 1.0, 0.4 },
+                          [](double value) { return "Avg " + juce::String(juce::roundToInt(value)) + " ms"; });
+    setUpBallisticsSlider(analyserDecaySlider, audioProcessor.analyserDecayDbPerSecond, { 3.0, 120.0, 0.5, 0.5 },
+                          [](double value) { return "Decay " + juce::String(value, 1) + " dB/s"; });
+    setUpBallisticsSlider(analyserPeakHoldSlider, audioProcessor.analyserPeakHoldMs, { 0.0, 10000.0, 10.0, 0.4 },
+                          [](double value) { return "Hold " + juce::String(juce::roundToInt(value)) + " ms"; });
+
     for (auto* comp : getComps()) {
         addAndMakeVisible(comp);
     }
 
-    peak1BypassButton.setLookAndFeel(&lnf);
-    peak2BypassButton.setLookAndFeel(&lnf);
-    peak3BypassButton.setLookAndFeel(&lnf);
-    lowCutBypassButton.setLookAndFeel(&lnf);
-    highCutBypassButton.setLookAndFeel(&lnf);
-    analyserEnabledButton.setLookAndFeel(&lnf);
+    lowCutBypassButton.setLookAndFeel(lnf.get());
+    highCutBypassButton.setLookAndFeel(lnf.get());
+    analyserEnabledButton.setLookAndFeel(lnf.get());
+    preEQViewButton.setLookAndFeel(lnf.get());
+    deltaViewButton.setLookAndFeel(lnf.get());
+    autoGainButton.setLookAndFeel(lnf.get());
+    storeAButton.setLookAndFeel(lnf.get());
+    storeBButton.setLookAndFeel(lnf.get());
+    morphEnabledButton.setLookAndFeel(lnf.get());
+    matchLearnButton.setLookAndFeel(lnf.get());
+    matchReferenceButton.setLookAndFeel(lnf.get());
+    matchButton.setLookAndFeel(lnf.get());
 
     auto safePtr = juce::Component::SafePointer<SimpleEQFromTutorialAudioProcessorEditor>(this);
-    peak1BypassButton.onClick = [safePtr]() {
-        if (auto* comp = safePtr.getComponent()) {
-            auto bypassed = comp->peak1BypassButton.getToggleState();
-            comp->peak1FreqSlider.setEnabled(!bypassed);
-            comp->peak1GainSlider.setEnabled(!bypassed);
-            comp->peak1QualitySlider.setEnabled(!bypassed);
-        }
+    //the attachment sets the count before this is wired up, so the selector is filled by hand the first time
+    peakCountSlider.setTextBoxStyle(juce::Slider::TextBoxLeft, false, 30, 20);
+    peakCountSlider.onValueChange = [safePtr]() {
+        if (auto* comp = safePtr.getComponent())
+            comp->updatePeakSelector();
     };
-
-    peak2BypassButton.onClick = [safePtr]() {
-        if (auto* comp = safePtr.getComponent()) {
-            auto bypassed = comp->peak2BypassButton.getToggleState();
-            comp->peak2FreqSlider.setEnabled(!bypassed);
-            comp->peak2GainSlider.setEnabled(!bypassed);
-            comp->peak2QualitySlider.setEnabled(!bypassed);
-        }
+    peakSelector.onChange = [safePtr]() {
+        if (auto* comp = safePtr.getComponent())
+            if (comp->peakSelector.getSelectedId() > 0)
+                comp->showPeak(comp->peakSelector.getSelectedId() - 1);
     };
+    updatePeakSelector();
+    showPeak(0);
 
-    peak3BypassButton.onClick = [safePtr]() {
-        if (auto* comp = safePtr.getComponent()) {
-            auto bypassed = comp->peak3BypassButton.getToggleState();
-            comp->peak3FreqSlider.setEnabled(!bypassed);
-            comp->peak3GainSlider.setEnabled(!bypassed);
-            comp->peak3QualitySlider.setEnabled(!bypassed);
-        }
-    };
     lowCutBypassButton.onClick = [safePtr]() {
         if (auto* comp = safePtr.getComponent()) {
             auto bypassed = comp->lowCutBypassButton.getToggleState();
@@ -561,23 +939,173 @@ SimpleEQFromTutorialAudioProcessorEditor::SimpleEQFromTutorialAudioProcessorEdit
         }
     };
 
-    analyserEnabledButton.onClick = [safePtr]() {
+    auto updateViews = [safePtr]() {
         if (auto* comp = safePtr.getComponent()) {
-            auto enabled = comp->analyserEnabledButton.getToggleState();
-            comp->responseCurveComponent.toggleAnalysisEnablement(enabled);
+            comp->responseCurveComponent.setAnalyserViews(comp->preEQViewButton.getToggleState(),
+                                                          comp->deltaViewButton.getToggleState());
         }
     };
+    preEQViewButton.onClick = updateViews;
+    deltaViewButton.onClick = updateViews;
+
+    storeAButton.setClickingTogglesState(false);
+    storeBButton.setClickingTogglesState(false);
+    storeAButton.onClick = [safePtr]() {
+        if (auto* comp = safePtr.getComponent()) {
+            comp->audioProcessor.storeSnapshot(SimpleEQFromTutorialAudioProcessor::SnapshotA);
+            comp->updateSnapshotButtons();
+        }
+    };
+    storeBButton.onClick = [safePtr]() {
+        if (auto* comp = safePtr.getComponent()) {
+            comp->audioProcessor.storeSnapshot(SimpleEQFromTutorialAudioProcessor::SnapshotB);
+            comp->updateSnapshotButtons();
+        }
+    };
+    updateSnapshotButtons();
+
+    //learning follows the analyser feed, nothing is captured while the analyser is off
+    matchLearnButton.onClick = [safePtr]() {
+        if (auto* comp = safePtr.getComponent())
+            comp->responseCurveComponent.setMatchCaptureEnabled(comp->matchLearnButton.getToggleState());
+    };
+    matchReferenceButton.setClickingTogglesState(false);
+    matchReferenceButton.onClick = [safePtr]() {
+        if (auto* comp = safePtr.getComponent()) {
+            comp->referenceChooser = std::make_unique<juce::FileChooser>("Reference audio", juce::File(),
+                                                                         "*.wav;*.aif;*.aiff;*.flac;*.ogg");
+            comp->referenceChooser->launchAsync(juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles,
+                                                [safePtr](const juce::FileChooser& chooser) {
+                if (auto* editor = safePtr.getComponent()) {
+                    auto file = chooser.getResult();
+                    if (file.existsAsFile())
+                        editor->startReferenceAnalysis(file);
+                }
+            });
+        }
+    };
+    matchButton.setClickingTogglesState(false);
+    matchButton.onClick = [safePtr]() {
+        if (auto* comp = safePtr.getComponent())
+            comp->startMatch();
+    };
 
     setSize (600, 480);
+   #if SIMPLEEQ_TRACING
+    setWantsKeyboardFocus(true);
+   #endif
 }
 
 SimpleEQFromTutorialAudioProcessorEditor::~SimpleEQFromTutorialAudioProcessorEditor() {
-    peak1BypassButton.setLookAndFeel(nullptr);
-    peak2BypassButton.setLookAndFeel(nullptr);
-    peak3BypassButton.setLookAndFeel(nullptr);
     lowCutBypassButton.setLookAndFeel(nullptr);
     highCutBypassButton.setLookAndFeel(nullptr);
     analyserEnabledButton.setLookAndFeel(nullptr);
+    preEQViewButton.setLookAndFeel(nullptr);
+    deltaViewButton.setLookAndFeel(nullptr);
+    autoGainButton.setLookAndFeel(nullptr);
+    storeAButton.setLookAndFeel(nullptr);
+    storeBButton.setLookAndFeel(nullptr);
+    morphEnabledButton.setLookAndFeel(nullptr);
+    matchLearnButton.setLookAndFeel(nullptr);
+    matchReferenceButton.setLookAndFeel(nullptr);
+    matchButton.setLookAndFeel(nullptr);
+}
+
+#if SIMPLEEQ_TRACING
+bool SimpleEQFromTutorialAudioProcessorEditor::keyPressed(const juce::KeyPress& key) {
+    if (key == juce::KeyPress('t', juce::ModifierKeys::commandModifier | juce::ModifierKeys::shiftModifier, 0)) {
+        auto file = juce::File::getSpecialLocation(juce::File::userDesktopDirectory)
+                        .getNonexistentChildFile("SimpleEQ trace " + juce::Time::getCurrentTime().formatted("%Y-%m-%d %H-%M-%S"), ".json");
+        if (TraceRecorder::writeChromeTrace(file))
+            DBG("SimpleEQ trace written to " << file.getFullPathName());
+        return true;
+    }
+    return false;
+}
+#endif
+
+void SimpleEQFromTutorialAudioProcessorEditor::updateSnapshotButtons() {
+    storeAButton.setToggleState(audioProcessor.hasSnapshot(SimpleEQFromTutorialAudioProcessor::SnapshotA), juce::dontSendNotification);
+    storeBButton.setToggleState(audioProcessor.hasSnapshot(SimpleEQFromTutorialAudioProcessor::SnapshotB), juce::dontSendNotification);
+    responseCurveComponent.snapshotsChanged();
+}
+
+namespace {
+    //reads the whole file, so it polls shouldExit() between blocks and gives up when the pool is torn down
+    struct ReferenceAnalysisJob : juce::ThreadPoolJob {
+        using Callback = std::function<void(const AverageSpectrum&)>;
+
+        ReferenceAnalysisJob(const juce::File& f, Callback cb) : juce::ThreadPoolJob("Reference analysis"), file(f), onDone(std::move(cb)) {}
+
+        JobStatus runJob() override {
+            WelchAnalyser analyser;
+            if (analyseAudioFile(file, analyser, [this] { return shouldExit(); }))
+                juce::MessageManager::callAsync([spectrum = analyser.getSpectrum(), cb = onDone] { cb(spectrum); });
+            return jobHasFinished;
+        }
+
+        juce::File file;
+        Callback onDone;
+    };
+}
+
+juce::ThreadPool& SimpleEQFromTutorialAudioProcessorEditor::getMatchPool() {
+    if (matchPool == nullptr)
+        matchPool = std::make_unique<juce::ThreadPool>(juce::ThreadPoolOptions{}.withThreadName("SimpleEQ match")
+                                                                                .withNumberOfThreads(1)
+                                                                                .withThreadPriority(juce::Thread::Priority::background));
+    return *matchPool;
+}
+
+void SimpleEQFromTutorialAudioProcessorEditor::startReferenceAnalysis(const juce::File& file) {
+    auto safePtr = juce::Component::SafePointer<SimpleEQFromTutorialAudioProcessorEditor>(this);
+    getMatchPool().addJob(new ReferenceAnalysisJob(file, [safePtr](const AverageSpectrum& spectrum) {
+        if (auto* comp = safePtr.getComponent()) {
+            comp->matchReference = spectrum;
+            comp->matchReferenceButton.setToggleState(true, juce::dontSendNotification);
+        }
+    }), true);
+}
+
+void SimpleEQFromTutorialAudioProcessorEditor::startMatch() {
+    auto input = responseCurveComponent.getCapturedInput();
+    if (input.isEmpty() || matchReference.isEmpty())
+        return;
+
+    //fits from what the parameters hold now, not the morphed settings, since that's what gets written back
+    auto start = getChainSettings(audioProcessor.apvts);
+    auto sampleRate = audioProcessor.getSampleRate();
+    auto safePtr = juce::Component::SafePointer<SimpleEQFromTutorialAudioProcessorEditor>(this);
+    getMatchPool().addJob([input, reference = matchReference, sampleRate, start, safePtr] {
+        ChainSettings result;
+        if (fitMatchEQ(input, reference, sampleRate, start, result)) {
+            juce::MessageManager::callAsync([safePtr, result] {
+                if (auto* comp = safePtr.getComponent())
+                    comp->applyChainSettings(result);
+            });
+        }
+    });
+}
+
+void SimpleEQFromTutorialAudioProcessorEditor::applyChainSettings(const ChainSettings& settings) {
+    auto set = [this](const juce::String& id, float value) {
+        if (auto* param = audioProcessor.apvts.getParameter(id)) {
+            param->beginChangeGesture();
+            param->setValueNotifyingHost(param->convertTo0to1(value));
+            param->endChangeGesture();
+        }
+    };
+
+    set("LowCut Freq", settings.lowCutFreq);
+    set("HighCut Freq", settings.highCutFreq);
+    for (int i = 0; i < settings.numPeaks; ++i) {
+        auto prefix = getPeakParameterPrefix(i);
+        const auto& peak = settings.peaks[i];
+        set(prefix + "Freq", peak.freq);
+        set(prefix + "Gain", peak.gainInDecibels);
+        set(prefix + "Quality", peak.quality);
+        set(prefix + "Bypass", peak.bypass ? 1.0f : 0.0f);
+    }
 }
 
 //==============================================================================
@@ -596,12 +1124,34 @@ void SimpleEQFromTutorialAudioProcessorEditor::resized() {
     analyserEnabledArea.setX(5);
     analyserEnabledArea.removeFromTop(2);
     analyserEnabledButton.setBounds(analyserEnabledArea);
+    preEQViewButton.setBounds(analyserEnabledArea.withX(analyserEnabledArea.getRight() + 5).withWidth(50));
+    deltaViewButton.setBounds(preEQViewButton.getBounds().withX(preEQViewButton.getRight() + 5));
+    autoGainButton.setBounds(deltaViewButton.getBounds().withX(deltaViewButton.getRight() + 10));
+
+    auto morphArea = getLocalBounds().removeFromTop(25).withTrimmedTop(2).withTrimmedRight(5);
+    morphArea.removeFromLeft(autoGainButton.getRight() + 15);
+    storeAButton.setBounds(morphArea.removeFromLeft(25));
+    morphArea.removeFromLeft(5);
+    matchButton.setBounds(morphArea.removeFromRight(50));
+    matchReferenceButton.setBounds(morphArea.removeFromRight(40));
+    matchLearnButton.setBounds(morphArea.removeFromRight(50));
+    morphArea.removeFromRight(10);
+    storeBButton.setBounds(morphArea.removeFromRight(25));
+    morphArea.removeFromRight(5);
+    morphEnabledButton.setBounds(morphArea.removeFromLeft(50));
+    morphSlider.setBounds(morphArea);
     bounds.removeFromTop(5);
 
     auto responseArea = bounds.removeFromTop(bounds.getHeight() * 0.25f);
 
     responseCurveComponent.setBounds(responseArea);
 
+    auto ballisticsArea = bounds.removeFromTop(20).withTrimmedTop(2).reduced(5, 0);
+    const auto ballisticsWidth = ballisticsArea.getWidth() / 3;
+    analyserAveragingSlider.setBounds(ballisticsArea.removeFromLeft(ballisticsWidth).withTrimmedRight(5));
+    analyserPeakHoldSlider.setBounds(ballisticsArea.removeFromRight(ballisticsWidth).withTrimmedLeft(5));
+    analyserDecaySlider.setBounds(ballisticsArea);
+
     bounds.removeFromTop(5);
 
     auto lowCutArea = bounds.removeFromLeft(bounds.getWidth() * 0.33f);
@@ -615,23 +1165,90 @@ void SimpleEQFromTutorialAudioProcessorEditor::resized() {
     highCutFreqSlider.setBounds(highCutArea.removeFromTop(highCutArea.getHeight() * 0.5f));
     highCutSlopeSlider.setBounds(highCutArea);
 
-    peak1BypassButton.setBounds(bounds.removeFromTop(25));
-    peak1FreqSlider.setBounds(bounds.removeFromTop(bounds.getHeight() * 0.33f));
-    peak1GainSlider.setBounds(bounds.removeFromTop(bounds.getHeight() * 0.5f));
-    peak1QualitySlider.setBounds(bounds);
+    auto peakHeader = bounds.removeFromTop(25).withTrimmedTop(2);
+    peakCountSlider.setBounds(peakHeader.removeFromRight(90));
+    peakSelector.setBounds(peakHeader.withTrimmedRight(5));
+    peakControlsArea = bounds;
+    if (peakControls != nullptr)
+        peakControls->setBounds(peakControlsArea);
+}
+
+void SimpleEQFromTutorialAudioProcessorEditor::updatePeakSelector() {
+    const auto numPeaks = juce::jlimit(1, MaxPeakBands, juce::roundToInt(peakCountSlider.getValue()));
+    if (peakSelector.getNumItems() == numPeaks)
+        return;
+
+    peakSelector.clear(juce::dontSendNotification);
+    for (int peak = 0; peak < numPeaks; ++peak)
+        peakSelector.addItem("Peak " + juce::String(peak + 1), peak + 1);
+
+    //a peak that's no longer counted hands the knobs to the last one that is
+    if (shownPeak >= numPeaks)
+        showPeak(numPeaks - 1);
+    else
+        peakSelector.setSelectedId(shownPeak + 1, juce::dontSendNotification);
+}
+
+void SimpleEQFromTutorialAudioProcessorEditor::showPeak(int peak) {
+    if (peakControls != nullptr && peak == shownPeak)
+        return;
+
+    shownPeak = peak;
+    peakControls.reset();
+    peakControls = std::make_unique<PeakBandControls>(audioProcessor.apvts, peak);
+    addAndMakeVisible(*peakControls);
+    peakControls->setBounds(peakControlsArea);
+    peakSelector.setSelectedId(peak + 1, juce::dontSendNotification);
+}
+
+//==============================================================================
+PeakBandControls::PeakBandControls(juce::AudioProcessorValueTreeState& apvts, int peak) :
+    freqSlider(*apvts.getParameter(getPeakParameterPrefix(peak) + "Freq"), "Hz"),
+    gainSlider(*apvts.getParameter(getPeakParameterPrefix(peak) + "Gain"), "dB"),
+    qualitySlider(*apvts.getParameter(getPeakParameterPrefix(peak) + "Quality"), ""),
+    freqSliderAttachment(apvts, getPeakParameterPrefix(peak) + "Freq", freqSlider),
+    gainSliderAttachment(apvts, getPeakParameterPrefix(peak) + "Gain", gainSlider),
+    qualitySliderAttachment(apvts, getPeakParameterPrefix(peak) + "Quality", qualitySlider),
+    bypassButtonAttachment(apvts, getPeakParameterPrefix(peak) + "Bypass", bypassButton)
+{
+    freqSlider.labels.add({ 0.0f, "20Hz" });
+    freqSlider.labels.add({ 1.0f, "20khz" });
+    gainSlider.labels.add({ 0.0f, "-24dB" });
+    gainSlider.labels.add({ 1.0f, "24dB" });
+    qualitySlider.labels.add({ 0.0f, "0.1" });
+    qualitySlider.labels.add({ 1.0f, "10.0" });
+
+    bypassButton.setLookAndFeel(lnf.get());
+    //every toggle change lands here, from a click, the host, a state recall or the match writing the parameter
+    bypassButton.onStateChange = [this]() { updateEnablement(); };
+    updateEnablement();
+
+    for (auto* comp : { static_cast<juce::Component*>(&bypassButton), static_cast<juce::Component*>(&freqSlider),
+                        static_cast<juce::Component*>(&gainSlider), static_cast<juce::Component*>(&qualitySlider) })
+        addAndMakeVisible(comp);
+}
+
+PeakBandControls::~PeakBandControls() {
+    bypassButton.setLookAndFeel(nullptr);
+}
+
+void PeakBandControls::updateEnablement() {
+    auto bypassed = bypassButton.getToggleState();
+    freqSlider.setEnabled(!bypassed);
+    gainSlider.setEnabled(!bypassed);
+    qualitySlider.setEnabled(!bypassed);
+}
+
+void PeakBandControls::resized() {
+    auto bounds = getLocalBounds();
+    bypassButton.setBounds(bounds.removeFromTop(25));
+    freqSlider.setBounds(bounds.removeFromTop(bounds.getHeight() * 0.33f));
+    gainSlider.setBounds(bounds.removeFromTop(bounds.getHeight() * 0.5f));
+    qualitySlider.setBounds(bounds);
 }
 
 std::vector<juce::Component*> SimpleEQFromTutorialAudioProcessorEditor::getComps() {
     return {
-        &peak1FreqSlider,
-        &peak1GainSlider,
-        &peak1QualitySlider,
-        &peak2FreqSlider,
-        &peak2GainSlider,
-        &peak2QualitySlider,
-        &peak3FreqSlider,
-        &peak3GainSlider,
-        &peak3QualitySlider,
         &lowCutFreqSlider,
         &highCutFreqSlider,
         &lowCutSlopeSlider,
@@ -639,9 +1256,21 @@ std::vector<juce::Component*> SimpleEQFromTutorialAudioProcessorEditor::getComps
         &responseCurveComponent,
         &lowCutBypassButton,
         &highCutBypassButton,
-        &peak1BypassButton,
-        &peak2BypassButton,
-        &peak3BypassButton,
-        &analyserEnabledButton
+        &analyserEnabledButton,
+        &preEQViewButton,
+        &deltaViewButton,
+        &autoGainButton,
+        &storeAButton,
+        &storeBButton,
+        &morphEnabledButton,
+        &morphSlider,
+        &analyserAveragingSlider,
+        &analyserDecaySlider,
+        &analyserPeakHoldSlider,
+        &matchLearnButton,
+        &matchReferenceButton,
+        &matchButton,
+        &peakCountSlider,
+        &peakSelector
     };
 }
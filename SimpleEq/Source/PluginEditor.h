@@ -13,24 +13,49 @@
 
 enum FFTOrder
 {
+    order1024 = 10,
     order2048 = 11,
     order4096 = 12,
     order8192 = 13
 };
 
+/**
+ analyzer state every plugin instance in the process can share: FFT plans and window tables per order, and the
+ worker pool the analysis runs on. the frame tick isn't in here, every editor follows its own display's vblank,
+ so one that's hidden or on another monitor doesn't hold up the rest. hold it through a juce::SharedResourcePointer,
+ it lives as long as the last editor that uses it. JUCE's default FFT engines keep no per call state, so one plan
+ can be run from several workers at once
+ */
+struct AnalyzerResources
+{
+    const juce::dsp::FFT& getFFT(FFTOrder order);
+    const juce::dsp::WindowingFunction<float>& getWindow(FFTOrder order);
+    juce::ThreadPool& getPool() { return pool; }
+private:
+    static constexpr int NumOrders = FFTOrder::order8192 - FFTOrder::order1024 + 1;
+    juce::CriticalSection lock;
+    std::array<std::unique_ptr<juce::dsp::FFT>, NumOrders> ffts;
+    std::array<std::unique_ptr<juce::dsp::WindowingFunction<float>>, NumOrders> windows;
+    juce::ThreadPool pool{ juce::ThreadPoolOptions{}.withThreadName("SimpleEQ analyzer")
+                                                    .withNumberOfThreads(juce::jlimit(1, 4, juce::SystemStats::getNumCpus() / 2)) };
+};
+
 template<typename BlockType>
 struct FFTDataGenerator
 {
     /**
-     produces the FFT data from an audio buffer.
+     produces the FFT data from a window of audio.
+     the window may come in two blocks (like AbstractFifo's blockSize1/2) so ring buffers can be read without unrolling them first.
+     returns the dB magnitudes, valid until the next call.
      */
-    void produceFFTDataForRendering(const juce::AudioBuffer<float>& audioData, const float negativeInfinity)
+    const BlockType& produceFFTDataForRendering(const float* block1, int size1, const float* block2, int size2, const float negativeInfinity)
     {
         const auto fftSize = getFFTSize();
+        jassert(size1 + size2 == fftSize);
 
-        fftData.assign(fftData.size(), 0);
-        auto* readIndex = audioData.getReadPointer(0);
-        std::copy(readIndex, readIndex + fftSize, fftData.begin());
+        std::copy(block1, block1 + size1, fftData.begin());
+        std::copy(block2, block2 + size2, fftData.begin() + size1);
+        std::fill(fftData.begin() + fftSize, fftData.end(), 0.0f);
 
         // first apply a windowing function to our data
         window->multiplyWithWindowingTable(fftData.data(), fftSize);       // [1]
@@ -38,13 +63,87 @@ struct FFTDataGenerator
         // then render our FFT data..
         forwardFFT->performFrequencyOnlyForwardTransform(fftData.data());  // [2]
 
-        int numBins = (int)fftSize / 2;
+        normalizeAndConvertToDecibels(fftData.data(), negativeInfinity);
+
+        return fftData;
+    }
+
+    /**
+     produces the FFT data of two equally long windows at once, packing one into the real and the
+     other into the imaginary part of a single complex FFT. both windows are read from rings whose
+     oldest sample sits at 'oldestIndex'. results are written as dB magnitudes into 'first' and 'second'.
+     */
+    void produceFFTDataForRendering(const BlockType& firstRing, const BlockType& secondRing, int oldestIndex,
+                                    const float negativeInfinity, BlockType& first, BlockType& second)
+    {
+        const auto fftSize = getFFTSize();
+        const int numBins = fftSize / 2;
+        jassert((int)firstRing.size() == fftSize && (int)secondRing.size() == fftSize);
+
+        auto unroll = [oldestIndex, fftSize](const BlockType& ring, float* dest)
+            {
+                std::copy(ring.begin() + oldestIndex, ring.end(), dest);
+                std::copy(ring.begin(), ring.begin() + oldestIndex, dest + fftSize - oldestIndex);
+            };
+
+        unroll(firstRing, fftData.data());
+        unroll(secondRing, fftData.data() + fftSize);
+        window->multiplyWithWindowingTable(fftData.data(), fftSize);
+        window->multiplyWithWindowingTable(fftData.data() + fftSize, fftSize);
+
+        for (int i = 0; i < fftSize; ++i)
+            complexTime[i] = { fftData[i], fftData[fftSize + i] };
+
+        forwardFFT->perform(complexTime.data(), complexFreq.data(), false);
+
+        //a real signal has a conjugate symmetric spectrum, an imaginary one an anti-symmetric spectrum,
+        //so the two halves can be pulled apart again from bins k and N - k
+        for (int k = 0; k < numBins; ++k)
+        {
+            auto z = complexFreq[k];
+            auto zMirror = std::conj(complexFreq[(fftSize - k) & (fftSize - 1)]);
+            first[k] = std::abs(z + zMirror) * 0.5f;
+            second[k] = std::abs(z - zMirror) * 0.5f;
+        }
+
+        normalizeAndConvertToDecibels(first.data(), negativeInfinity);
+        normalizeAndConvertToDecibels(second.data(), negativeInfinity);
+    }
+
+    void changeOrder(FFTOrder newOrder)
+    {
+        //the plan and the window are shared with every other analyzer, only the buffers are ours
+        order = newOrder;
+        auto fftSize = getFFTSize();
+
+        forwardFFT = &resources->getFFT(order);
+        window = &resources->getWindow(order);
+
+        fftData.clear();
+        fftData.resize(fftSize * 2, 0);
+
+        complexTime.assign(fftSize, {});
+        complexFreq.assign(fftSize, {});
+    }
+    //==============================================================================
+    int getFFTSize() const { return 1 << order; }
+private:
+    FFTOrder order;
+    BlockType fftData;
+    std::vector<std::complex<float>> complexTime, complexFreq;
+    const juce::dsp::FFT* forwardFFT = nullptr;
+    const juce::dsp::WindowingFunction<float>* window = nullptr;
+    juce::SharedResourcePointer<AnalyzerResources> resources;
+
+    void normalizeAndConvertToDecibels(float* data, const float negativeInfinity) const
+    {
+        int numBins = getFFTSize() / 2;
 
         //normalize the fft values.
         for (int i = 0; i < numBins; ++i)
         {
-            auto v = fftData[i];
-            //            fftData[i] /= (float) numBins;
+            auto v = data[i];
+            //            data[i] /= (float) numBins;
             if (!std::isinf(v) && !std::isnan(v))
             {
                 v /= float(numBins);
@@ -53,100 +152,421 @@ struct FFTDataGenerator
             {
                 v = 0.f;
             }
-            fftData[i] = v;
+            data[i] = v;
         }
 
         //convert them to decibels
         for (int i = 0; i < numBins; ++i)
         {
-            fftData[i] = juce::Decibels::gainToDecibels(fftData[i], negativeInfinity);
+            data[i] = juce::Decibels::gainToDecibels(data[i], negativeInfinity);
+        }
+    }
+};
+
+/**
+ 31 tap half-band lowpass followed by a drop of every other sample.
+ every second tap of a half-band filter is zero, so an output sample costs 8 multiplies.
+ */
+struct HalfBandDecimator
+{
+    HalfBandDecimator()
+    {
+        //windowed sinc at fs/4, only the odd offsets from the centre are non-zero
+        float sum = 0.5f;
+        for (int i = 0; i < NumCoeffs; ++i)
+        {
+            auto offset = 2 * i + 1;
+            auto phi = juce::MathConstants<float>::twoPi * float(Centre + offset + 1) / float(NumTaps + 1);
+            auto w = 0.42f - 0.5f * std::cos(phi) + 0.08f * std::cos(2.0f * phi);
+            auto x = juce::MathConstants<float>::halfPi * offset;
+            coeffs[i] = 0.5f * std::sin(x) / x * w;
+            sum += 2.0f * coeffs[i];
         }
 
-        fftDataFifo.push(fftData);
+        //unity gain at dc
+        for (auto& c : coeffs)
+            c /= sum;
+        centreCoeff = 0.5f / sum;
+
+        reset();
     }
 
-    void changeOrder(FFTOrder newOrder)
+    void reset()
     {
-        //when you change order, recreate the window, forwardFFT, fifo, fftData
-        //also reset the fifoIndex
-        //things that need recreating should be created on the heap via std::make_unique<>
+        delay.fill(0.0f);
+        writePos = 0;
+        phase = 0;
+    }
 
-        order = newOrder;
-        auto fftSize = getFFTSize();
+    //returns how many samples were written to 'out', at most (numIn + 1) / 2
+    int process(const float* in, int numIn, float* out)
+    {
+        int numOut = 0;
+        for (int i = 0; i < numIn; ++i)
+        {
+            //every sample is written twice so the last NumTaps samples are always contiguous
+            writePos = writePos == NumTaps - 1 ? 0 : writePos + 1;
+            delay[writePos] = delay[writePos + NumTaps] = in[i];
 
-        forwardFFT = std::make_unique<juce::dsp::FFT>(order);
-        window = std::make_unique<juce::dsp::WindowingFunction<float>>(fftSize, juce::dsp::WindowingFunction<float>::blackmanHarris);
+            phase ^= 1;
+            if (phase != 0)
+                continue;
 
-        fftData.clear();
-        fftData.resize(fftSize * 2, 0);
+            const auto* x = delay.data() + writePos + 1;
+            auto y = centreCoeff * x[Centre];
+            for (int c = 0; c < NumCoeffs; ++c)
+            {
+                auto offset = 2 * c + 1;
+                y += coeffs[c] * (x[Centre - offset] + x[Centre + offset]);
+            }
+            out[numOut++] = y;
+        }
+        return numOut;
+    }
+private:
+    static constexpr int NumTaps = 31;
+    static constexpr int Centre = NumTaps / 2;
+    static constexpr int NumCoeffs = (Centre + 1) / 2;
+
+    std::array<float, NumCoeffs> coeffs;
+    float centreCoeff = 0.5f;
+    std::array<float, NumTaps * 2> delay;
+    int writePos = 0;
+    int phase = 0;
+};
 
-        fftDataFifo.prepare(fftData.size());
+template<typename BlockType>
+struct MultiResolutionFFTGenerator
+{
+    /**
+     runs one small FFT per octave. level 0 sees the input, every following level sees the
+     previous one decimated by two, so the same FFT size gives twice the resolution an octave lower.
+     the cost of all levels together is under twice the cost of level 0 alone.
+     with the pre-EQ tap enabled both taps share each level's FFT, see FFTDataGenerator.
+     */
+    void prepare(double newSampleRate, FFTOrder order)
+    {
+        sampleRate = newSampleRate;
+        fftDataGenerator.changeOrder(order);
+        const auto fftSize = fftDataGenerator.getFFTSize();
+        hopSize = fftSize / 4;
+
+        //keep adding octaves until the lowest one resolves a few Hz
+        int numLevels = 1;
+        while (numLevels < MaxLevels && getLevelSampleRate(numLevels - 1) / fftSize > TargetResolutionHz)
+            ++numLevels;
+
+        levels.resize(numLevels);
+        reset();
     }
-    //==============================================================================
-    int getFFTSize() const { return 1 << order; }
-    int getNumAvailableFFTDataBlocks() const { return fftDataFifo.getNumAvailableForReading(); }
-    //==============================================================================
-    bool getFFTData(BlockType& fftData) { return fftDataFifo.pull(fftData); }
+
+    void reset()
+    {
+        if (levels.empty())
+            return;
+
+        const auto fftSize = fftDataGenerator.getFFTSize();
+        for (auto& level : levels)
+        {
+            for (auto& tap : level.taps)
+            {
+                tap.ring.assign(fftSize, 0.0f);
+                tap.spectrum.assign(fftSize / 2, NegativeInfinity);
+                tap.decimated.assign(hopSize / 2 + 1, 0.0f);
+                tap.decimator.reset();
+            }
+            level.writePos = 0;
+            level.newSamples = 0;
+        }
+        frameReady = false;
+    }
+
+    //the pre-EQ tap starts from silence every time it is switched on
+    void setPreEQTapEnabled(bool enabled)
+    {
+        if (enabled && !preEQTapEnabled)
+        {
+            for (auto& level : levels)
+            {
+                auto& tap = level.taps[AnalyzerTap::PreEQ];
+                std::fill(tap.ring.begin(), tap.ring.end(), 0.0f);
+                std::fill(tap.spectrum.begin(), tap.spectrum.end(), NegativeInfinity);
+                tap.decimator.reset();
+            }
+        }
+        preEQTapEnabled = enabled;
+    }
+
+    /**
+     consumes samples up to the next level 0 frame boundary and returns how many were used.
+     'preEQSamples' is only read while the pre-EQ tap is enabled.
+     call pullFrame() after each call to see if a new frame is ready.
+     */
+    int pushSamples(const float* postEQSamples, const float* preEQSamples, int numSamples)
+    {
+        jassert(!levels.empty());
+        auto num = juce::jmin(numSamples, hopSize - levels[0].newSamples);
+        pushIntoLevel(0, postEQSamples, preEQSamples, num);
+        return num;
+    }
+
+    bool pullFrame()
+    {
+        auto ready = frameReady;
+        frameReady = false;
+        return ready;
+    }
+
+    //each level owns the octave [rate / 8, rate / 4), the top level also owns everything above it
+    //and the bottom level everything below
+    int getLevelForFrequency(double freq) const
+    {
+        for (int i = 0; i < getNumLevels() - 1; ++i)
+        {
+            if (freq >= getLevelSampleRate(i) / 8.0)
+                return i;
+        }
+        return getNumLevels() - 1;
+    }
+
+    int getNumLevels() const { return (int)levels.size(); }
+    double getLevelSampleRate(int level) const { return sampleRate / double(1 << level); }
+    double getBinWidth(int level) const { return getLevelSampleRate(level) / fftDataGenerator.getFFTSize(); }
+    int getNumBins() const { return fftDataGenerator.getFFTSize() / 2; }
+    double getSampleRate() const { return sampleRate; }
+    float getFrameSeconds() const { return float(hopSize / sampleRate); }
+    bool isPreEQTapEnabled() const { return preEQTapEnabled; }
+    const BlockType& getSpectrum(int level, AnalyzerTap tap) const { return levels[level].taps[tap].spectrum; }
+
+    static constexpr float NegativeInfinity = -48.0f;
 private:
-    FFTOrder order;
-    BlockType fftData;
-    std::unique_ptr<juce::dsp::FFT> forwardFFT;
-    std::unique_ptr<juce::dsp::WindowingFunction<float>> window;
+    static constexpr int MaxLevels = 8;
+    static constexpr double TargetResolutionHz = 3.0;
+
+    struct TapState
+    {
+        HalfBandDecimator decimator;
+        BlockType ring, spectrum, decimated;
+    };
+
+    //both taps are written in lockstep so they share the write position
+    struct Level
+    {
+        std::array<TapState, NumAnalyzerTaps> taps;
+        int writePos = 0, newSamples = 0;
+    };
+
+    std::vector<Level> levels;
+    FFTDataGenerator<BlockType> fftDataGenerator;
+    double sampleRate = 0.0;
+    int hopSize = 0;
+    bool frameReady = false;
+    bool preEQTapEnabled = false;
+
+    void pushIntoLevel(int index, const float* postEQSamples, const float* preEQSamples, int numSamples)
+    {
+        auto& level = levels[index];
+        const int numTaps = preEQTapEnabled ? 2 : 1;
+        const float* samples[] = { postEQSamples, preEQSamples };
+        const float* decimated[] = { nullptr, nullptr };
+        int numDecimated = 0;
+
+        for (int t = 0; t < numTaps; ++t)
+        {
+            auto& tap = level.taps[t];
+            const auto fftSize = (int)tap.ring.size();
+            auto size1 = juce::jmin(numSamples, fftSize - level.writePos);
+            std::copy(samples[t], samples[t] + size1, tap.ring.begin() + level.writePos);
+            std::copy(samples[t] + size1, samples[t] + numSamples, tap.ring.begin());
+
+            if (index + 1 < getNumLevels())
+            {
+                numDecimated = tap.decimator.process(samples[t], numSamples, tap.decimated.data());
+                decimated[t] = tap.decimated.data();
+            }
+        }
+
+        level.writePos = (level.writePos + numSamples) % (int)level.taps[0].ring.size();
+        level.newSamples += numSamples;
+
+        if (numDecimated > 0)
+            pushIntoLevel(index + 1, decimated[AnalyzerTap::PostEQ], decimated[AnalyzerTap::PreEQ], numDecimated);
+
+        if (level.newSamples >= hopSize)
+        {
+            level.newSamples -= hopSize;
+
+            //oldest samples start at the write position
+            auto& post = level.taps[AnalyzerTap::PostEQ];
+            if (preEQTapEnabled)
+            {
+                auto& pre = level.taps[AnalyzerTap::PreEQ];
+                fftDataGenerator.produceFFTDataForRendering(post.ring, pre.ring, level.writePos, NegativeInfinity, post.spectrum, pre.spectrum);
+            }
+            else
+            {
+                const auto fftSize = (int)post.ring.size();
+                const auto& fftData = fftDataGenerator.produceFFTDataForRendering(post.ring.data() + level.writePos, fftSize - level.writePos,
+                                                                                  post.ring.data(), level.writePos, NegativeInfinity);
+                std::copy(fftData.begin(), fftData.begin() + post.spectrum.size(), post.spectrum.begin());
+            }
+
+            if (index == 0)
+                frameReady = true;
+        }
+    }
+};
+
+struct SpectrumBallisticsSettings
+{
+    float averagingMs = 80.0f;            //exponential averaging time constant, 0 shows raw frames
+    float attackMs = 5.0f;                //how quickly the display rises toward the average
+    float decayDbPerSecond = 36.0f;       //how quickly the display is allowed to fall
+    float peakHoldMs = 1500.0f;           //how long a peak sits still before it releases
+    float peakDecayDbPerSecond = 18.0f;   //release speed of the peak line once the hold runs out
+};
+
+template<typename BlockType>
+struct SpectrumBallistics
+{
+    /**
+     averaging, attack/decay and peak-hold, run in place on per-column dB data.
+     state is one value per column, so memory and cpu don't depend on the averaging time.
+     */
+    void prepare(int numColumns, float negativeInfinity)
+    {
+        floorDb = negativeInfinity;
+        for (auto* b : { &averaged, &display, &peaks, &scratchA, &scratchB })
+            b->assign(numColumns, negativeInfinity);
+        holdRemaining.assign(numColumns, 0.0f);
+        lastFrameSeconds = -1.0f;
+    }
+
+    void setSettings(const SpectrumBallisticsSettings& newSettings)
+    {
+        settings = newSettings;
+        lastFrameSeconds = -1.0f; //force the coefficients to be recomputed on the next frame
+    }
+
+    void process(const float* columnData, int numColumns, float frameSeconds)
+    {
+        using FVO = juce::FloatVectorOperations;
+        jassert(numColumns == (int)display.size());
+
+        if (frameSeconds != lastFrameSeconds)
+            updateCoefficients(frameSeconds);
+
+        auto* avg = averaged.data();
+        auto* disp = display.data();
+        auto* a = scratchA.data();
+        auto* b = scratchB.data();
+
+        //exponential average: avg += k * (in - avg)
+        FVO::subtract(a, columnData, avg, numColumns);
+        FVO::addWithMultiply(avg, a, averageCoeff, numColumns);
+
+        //attack: rise toward the average without overshooting it
+        FVO::subtract(a, avg, disp, numColumns);
+        FVO::max(a, a, 0.0f, numColumns);
+        FVO::copy(b, disp, numColumns);
+        FVO::addWithMultiply(b, a, attackCoeff, numColumns);
+
+        //decay: fall by a fixed step, never below the average.
+        //rising columns pick the attack value, falling ones the decay value
+        FVO::add(a, disp, -decayStep, numColumns);
+        FVO::max(a, a, avg, numColumns);
+        FVO::min(disp, b, a, numColumns);
+        FVO::max(disp, disp, floorDb, numColumns);
+
+        //peak hold. written with selects instead of branches so the compiler can vectorize it
+        auto* pk = peaks.data();
+        auto* hold = holdRemaining.data();
+        for (int i = 0; i < numColumns; ++i)
+        {
+            const bool newPeak = disp[i] >= pk[i];
+            const auto released = hold[i] > 0.0f ? pk[i] : pk[i] - peakDecayStep;
+            pk[i] = newPeak ? disp[i] : juce::jmax(released, disp[i]);
+            hold[i] = newPeak ? peakHoldSeconds : hold[i] - frameSeconds;
+        }
+    }
+
+    const BlockType& getDisplay() const { return display; }
+    const BlockType& getPeaks() const { return peaks; }
+private:
+    SpectrumBallisticsSettings settings;
+    BlockType averaged, display, peaks, holdRemaining, scratchA, scratchB;
+    float floorDb = -48.0f;
+    float lastFrameSeconds = -1.0f;
+    float averageCoeff = 1.0f, attackCoeff = 1.0f, decayStep = 0.0f, peakDecayStep = 0.0f, peakHoldSeconds = 0.0f;
+
+    void updateCoefficients(float frameSeconds)
+    {
+        //one-pole coefficient for a time constant, given how far apart the frames are
+        auto coeffFor = [frameSeconds](float ms)
+            {
+                return ms > 0.0f ? 1.0f - std::exp(-frameSeconds * 1000.0f / ms) : 1.0f;
+            };
 
-    Fifo<BlockType> fftDataFifo;
+        averageCoeff = coeffFor(settings.averagingMs);
+        attackCoeff = coeffFor(settings.attackMs);
+        decayStep = settings.decayDbPerSecond * frameSeconds;
+        peakDecayStep = settings.peakDecayDbPerSecond * frameSeconds;
+        peakHoldSeconds = settings.peakHoldMs * 0.001f;
+        lastFrameSeconds = frameSeconds;
+    }
 };
 
 template<typename PathType>
 struct AnalyzerPathGenerator
 {
     /*
-     converts 'renderData[]' into a juce::Path
+     converts per-column dB data into a juce::Path, one column per pixel
      */
-    void generatePath(const std::vector<float>& renderData,
+    void generatePath(const std::vector<float>& columnData,
         juce::Rectangle<float> fftBounds,
-        int fftSize,
-        float binWidth,
         float negativeInfinity)
     {
-        auto top = fftBounds.getY();
-        auto bottom = fftBounds.getHeight();
-        auto width = fftBounds.getWidth();
+        generatePath(columnData, negativeInfinity, 0.f, fftBounds.getHeight() + 10, fftBounds.getY());
+    }
+
+    /*
+     same, but maps [minDb, maxDb] onto [yForMin, yForMax]. used for curves that live on the EQ's gain scale
+     */
+    void generatePath(const std::vector<float>& columnData,
+        float minDb, float maxDb,
+        float yForMin, float yForMax)
+    {
+        SIMPLEEQ_TRACE_SCOPE("AnalyzerPathGenerator::generatePath");
+        auto numColumns = (int)columnData.size();
 
-        int numBins = (int)fftSize / 2;
+        if (numColumns == 0)
+            return;
 
         PathType p;
-        p.preallocateSpace(3 * (int)fftBounds.getWidth());
+        p.preallocateSpace(3 * numColumns);
 
-        auto map = [bottom, top, negativeInfinity](float v)
+        auto map = [minDb, maxDb, yForMin, yForMax](float v)
             {
                 return juce::jmap(v,
-                    negativeInfinity, 0.f,
-                    float(bottom + 10), top);
+                    minDb, maxDb,
+                    yForMin, yForMax);
             };
 
-        auto y = map(renderData[0]);
+        auto y = map(columnData[0]);
 
-        //        jassert( !std::isnan(y) && !std::isinf(y) );
         if (std::isnan(y) || std::isinf(y))
-            y = bottom;
+            y = yForMin;
 
         p.startNewSubPath(0, y);
 
         const int pathResolution = 2; //you can draw line-to's every 'pathResolution' pixels.
 
-        for (int binNum = 1; binNum < numBins; binNum += pathResolution)
+        for (int x = 1; x < numColumns; x += pathResolution)
         {
-            y = map(renderData[binNum]);
-
-            //            jassert( !std::isnan(y) && !std::isinf(y) );
+            y = map(columnData[x]);
 
             if (!std::isnan(y) && !std::isinf(y))
-            {
-                auto binFreq = binNum * binWidth;
-                auto normalizedBinX = juce::mapFromLog10(binFreq, 20.0f, 20000.0f);
-                int binX = std::floor(normalizedBinX * width);
-                p.lineTo(binX, y);
-            }
+                p.lineTo(x, y);
         }
 
         pathFifo.push(p);
@@ -162,20 +582,60 @@ struct AnalyzerPathGenerator
         return pathFifo.pull(path);
     }
 private:
-    Fifo<PathType> pathFifo;
+    //filled and drained once per analyzer frame, so a couple of slots are plenty
+    Fifo<PathType, 4> pathFifo;
 };
 
 
+/**
+ an image cache for one layer of a component. it is re-rendered at the display's physical resolution
+ whenever the size or scale changes or someone invalidates it, and blitted otherwise.
+ */
+struct RasterLayer {
+    RasterLayer(juce::Image::PixelFormat format) : pixelFormat(format) {}
+
+    template<typename RenderFunction>
+    void paint(juce::Graphics& g, juce::Rectangle<int> area, float scale, RenderFunction&& render) {
+        auto width = juce::roundToInt(area.getWidth() * scale);
+        auto height = juce::roundToInt(area.getHeight() * scale);
+        if (width <= 0 || height <= 0)
+            return;
+
+        if (image.getWidth() != width || image.getHeight() != height) {
+            image = juce::Image(pixelFormat, width, height, true);
+            valid = false;
+        }
+
+        if (!valid) {
+            image.clear(image.getBounds());
+            juce::Graphics ig(image);
+            ig.addTransform(juce::AffineTransform::scale(scale).translated(-area.getX() * scale, -area.getY() * scale));
+            render(ig);
+            valid = true;
+        }
+
+        g.drawImage(image, area.toFloat());
+    }
+
+    void invalidate() { valid = false; }
+private:
+    juce::Image::PixelFormat pixelFormat;
+    juce::Image image;
+    bool valid = false;
+};
+
 struct LookAndFeel : juce::LookAndFeel_V4 {
     void drawRotarySlider(juce::Graphics&, int x, int y, int width, int height, float
         sliderPosProportional, float rotaryStartAngle, float rotaryEndAngle, juce::Slider&) override;
     void drawToggleButton(juce::Graphics&, juce::ToggleButton&, bool highlighted, bool down) override;
+    static void drawRotaryBody(juce::Graphics&, juce::Rectangle<float> bounds, bool enabled);
 };
 
 struct RotarySliderWithLabels : juce::Slider {
     RotarySliderWithLabels(juce::RangedAudioParameter& rap, const juce::String& unitSuffix) : 
-        juce::Slider(juce::Slider::SliderStyle::RotaryHorizontalVerticalDrag, juce::Slider::TextEntryBoxPosition::NoTextBox), param(&rap), suffix(unitSuffix) {
-        setLookAndFeel(&lnf);
+        juce::Slider(juce::Slider::SliderStyle::RotaryHorizontalVerticalDrag, juce::Slider::TextEntryBoxPosition::NoTextBox), param(&rap), suffix(unitSuffix),
+        choiceParam(dynamic_cast<juce::AudioParameterChoice*>(&rap)) {
+        setLookAndFeel(lnf.get());
     }
 
     ~RotarySliderWithLabels() {
@@ -190,56 +650,177 @@ struct RotarySliderWithLabels : juce::Slider {
     juce::Array<LabelPos> labels;
 
     void paint(juce::Graphics& g) override;
+    void resized() override;
+    void enablementChanged() override;
     juce::Rectangle<int> getSliderBounds() const;
     int getTextHeight() const { return 14; }
     juce::String getDisplayString() const;
 
 private:
-    LookAndFeel lnf;
+    //one look and feel for every knob in the process
+    juce::SharedResourcePointer<LookAndFeel> lnf;
 
     juce::RangedAudioParameter* param;
     juce::String suffix;
+    juce::AudioParameterChoice* choiceParam;
+
+    //the knob body and range labels only change with size, scale or enablement, so they're
+    //rendered once into a layer. only the pointer and the value text are drawn per repaint,
+    //and the value text is only laid out again when the value changes
+    RasterLayer bodyLayer{ juce::Image::ARGB };
+    juce::Path pointer;
+    juce::GlyphArrangement valueGlyphs;
+    juce::Rectangle<float> valueTextBounds;
+    double valueTextFor = std::numeric_limits<double>::quiet_NaN();
+    void drawBody(juce::Graphics& g);
+    void updateValueText();
 };
 
 struct PathProducer {
-    PathProducer(SingleChannelSampleFifo<SimpleEQFromTutorialAudioProcessor::BlockType>& scsf) : leftChannelFifo(&scsf) {
-        leftChannelFFTDataGenerator.changeOrder(FFTOrder::order2048);
-        monoBuffer.setSize(1, leftChannelFFTDataGenerator.getFFTSize());
-    }
-    void process(juce::Rectangle<float> fftBounds, double sampleRate);
+    PathProducer(SingleChannelSampleFifo<SimpleEQFromTutorialAudioProcessor::BlockType>& scsf) : leftChannelFifo(&scsf) {}
+    //worker side. returns true if new paths were produced, collectPaths() picks them up
+    bool process(juce::Rectangle<float> fftBounds, double sampleRate);
+    //message thread side, keeps the newest of each path
+    void collectPaths();
     juce::Path getPath() { return leftChannelFFTPath; }
+    juce::Path getPeakPath() { return leftChannelPeakPath; }
+    juce::Path getPreEQPath() { return leftChannelPreEQPath; }
+    juce::Path getDeltaPath() { return leftChannelDeltaPath; }
+    void setBallistics(const SpectrumBallisticsSettings& settings) {
+        ballistics.setSettings(settings);
+        preEQBallistics.setSettings(settings);
+    }
+    //the pre-EQ spectrum and the delta both need the pre-EQ tap, the delta is post minus pre on the gain scale
+    void setViews(bool showPreEQ, bool showDelta);
+    //forget everything seen so far, including buffers queued before the analyzer was switched on
+    void restart();
+    //also feeds every pre-EQ block to 'analyser', nullptr stops. only while the analysis job isn't running
+    void setCapture(WelchAnalyser* analyser) { capture = analyser; }
 private:
     SingleChannelSampleFifo<SimpleEQFromTutorialAudioProcessor::BlockType>* leftChannelFifo;
-    juce::AudioBuffer<float> monoBuffer;
-    FFTDataGenerator<std::vector<float>> leftChannelFFTDataGenerator;
-    AnalyzerPathGenerator<juce::Path> pathProducer;
-    juce::Path leftChannelFFTPath;
+    juce::AudioBuffer<float> incomingBuffer;
+    MultiResolutionFFTGenerator<std::vector<float>> leftChannelFFTDataGenerator;
+    AnalyzerPathGenerator<juce::Path> pathProducer, peakPathProducer, preEQPathProducer, deltaPathProducer;
+    juce::Path leftChannelFFTPath, leftChannelPeakPath, leftChannelPreEQPath, leftChannelDeltaPath;
+    bool preEQViewEnabled = false, deltaViewEnabled = false;
+    WelchAnalyser* capture = nullptr;
+
+    //each pixel column reads bins [firstBin, lastBin] of one analyzer level. columns narrower
+    //than a bin have lastBin < firstBin and interpolate between firstBin and firstBin + 1 using frac
+    struct ColumnSpan {
+        int level, firstBin, lastBin;
+        float frac;
+    };
+    std::vector<ColumnSpan> columnSpans;
+    std::vector<float> columnData, deltaData;
+    SpectrumBallistics<std::vector<float>> ballistics, preEQBallistics;
+    void updateColumnMapping(int numColumns);
+    void mapBinsToColumns(AnalyzerTap tap);
 };
 
-struct ResponseCurveComponent : juce::Component, juce::AudioProcessorParameter::Listener, juce::Timer {
+struct ResponseCurveComponent : juce::Component, juce::AudioProcessorParameter::Listener {
     ResponseCurveComponent(SimpleEQFromTutorialAudioProcessor&);
     ~ResponseCurveComponent();
 
     void parameterValueChanged(int parameterIndex, float newValue) override;
     void parameterGestureChanged(int parameterIndex, bool gestureIsStarting) override {}
-    void timerCallback() override;
     void paint(juce::Graphics& g) override;
     void resized() override;
-    void toggleAnalysisEnablement(bool enabled) { shouldShowFFTAnalysis = enabled; }
+    void setAnalyserViews(bool showPreEQ, bool showDelta);
+    //A/B snapshots aren't parameters, so storing one has to ask for the curve explicitly
+    void snapshotsChanged() { dirtyBands.fetch_or(AllBands); }
+    //match-EQ learns the long-term pre-EQ spectrum of both channels on the analysis worker. enabling starts over
+    void setMatchCaptureEnabled(bool shouldCapture);
+    bool isMatchCaptureEnabled() const { return matchCaptureEnabled; }
+    AverageSpectrum getCapturedInput();
 
 private:
     SimpleEQFromTutorialAudioProcessor& audioProcessor;
-    juce::Atomic<bool> parametersChanged{ false };
-    MonoChain monoChain;
-    void updateChain();
-    juce::Image background;
+    //mono copy of the processor's bands, only ever designed, never processed
+    BandEngine engine;
+    ChainSettings chainSettings;
+    //rebuilds the coefficients of the bands in the mask only, bit n is BandIndex n
+    void updateChain(juce::uint32 bands);
+
+    //per band magnitudes in dB, one per column of the analysis area. a band is only
+    //recomputed when its settings, the width or the sample rate change
+    struct BandSnapshot {
+        float freq = 0.0f, gainInDecibels = 0.0f, quality = 0.0f;
+        int slope = -1;
+        bool bypassed = false;
+        bool operator==(const BandSnapshot& other) const {
+            return freq == other.freq && gainInDecibels == other.gainInDecibels && quality == other.quality
+                && slope == other.slope && bypassed == other.bypassed;
+        }
+    };
+    static constexpr juce::uint32 AllBands = (1u << NumBands) - 1;
+    //the peak count turns peaks on and off, so it dirties every one of them
+    static constexpr juce::uint32 AllPeakBands = ((1u << MaxPeakBands) - 1) << FirstPeakBand;
+
+    //parameter changes, possibly from the audio thread, only set their band's bit. the vblank callback
+    //drains them once per frame. parameterBands maps a parameter index to the bands it affects
+    std::atomic<juce::uint32> dirtyBands{ 0 };
+    std::vector<juce::uint32> parameterBands;
+    //bands whose coefficients were rebuilt since the curve was last updated
+    juce::uint32 pendingCurveBands = 0;
+    static BandSnapshot getBandSnapshot(const ChainSettings& settings, int band);
+    std::array<BandSnapshot, NumBands> bandSnapshots;
+    std::array<std::vector<float>, NumBands> bandMagnitudes;
+    std::vector<float> totalMagnitudes;
+    BiquadMagnitudeEvaluator magnitudeEvaluator;
+    double cachedSampleRate = 0.0;
+    juce::Rectangle<int> cachedResponseArea;
+    juce::Path responseCurve;
+    bool updateResponseCurve();
+
+    //the grid and the response curve are cached separately, only the analyzer is drawn live
+    RasterLayer gridLayer{ juce::Image::RGB }, responseCurveLayer{ juce::Image::ARGB };
+    void drawBackgroundGrid(juce::Graphics& g);
+    void updateBandMagnitudes(int band);
+
     juce::Rectangle<int> getRenderArea();
     juce::Rectangle<int> getAnalArea();
+    juce::SharedResourcePointer<AnalyzerResources> analyzerResources;
     PathProducer leftPathProducer, rightPathProducer;
-    bool shouldShowFFTAnalysis = true;
+    std::atomic<float>* analyserEnabled = nullptr;
+    //the processor's analyser display settings, handed to the producers between jobs
+    std::atomic<float>* analyserAveraging = nullptr;
+    std::atomic<float>* analyserDecay = nullptr;
+    std::atomic<float>* analyserPeakHold = nullptr;
+    SpectrumBallisticsSettings appliedBallistics;
+    void updateBallistics();
+    bool shouldShowFFTAnalysis = false;
+    bool showPreEQAnalysis = false, showDeltaAnalysis = false;
+    std::array<WelchAnalyser, 2> matchCapture;
+    bool matchCaptureEnabled = false;
+    void updatePreEQTap();
+
+    //the path producers run on the shared pool, one job per frame. while the job is queued or running the
+    //producers belong to it, the message thread only touches them again once the pool no longer holds it
+    struct AnalysisJob : juce::ThreadPoolJob {
+        AnalysisJob(ResponseCurveComponent& o) : juce::ThreadPoolJob("Analysis"), owner(o) {}
+        JobStatus runJob() override;
+        ResponseCurveComponent& owner;
+    };
+    AnalysisJob analysisJob{ *this };
+    juce::Rectangle<float> analysisBounds;
+    double analysisSampleRate = 0.0;
+    bool analysisGotFrame = false;
+    void waitForAnalysis();
+
+    //driven by this component's vblank, and only repaints when there's new analyzer data or a parameter changed
+    void analyzerFrame();
+    static constexpr int IdleAfterFrames = 60;
+    static constexpr int IdlePollDivider = 6;
+    int idleFrames = 0, idleSkip = 0;
+    //last, so it's gone before anything its callback touches. it only fires while the component is on screen
+    juce::VBlankAttachment vblank{ this, [this] { analyzerFrame(); } };
 };
 //==============================================================================
 struct PowerButton : juce::ToggleButton {};
+struct AnalyserViewButton : juce::ToggleButton {
+    AnalyserViewButton(const juce::String& text) : juce::ToggleButton(text) {}
+};
 struct AnalyserButton : juce::ToggleButton {
     void resized() override {
         auto bounds = getLocalBounds();
@@ -254,6 +835,26 @@ struct AnalyserButton : juce::ToggleButton {
     juce::Path randomPath;
 };
 
+//one peak's knobs and bypass. the editor builds these for the peak it shows, so an open editor holds
+//the same few attachments whatever the peak count is
+struct PeakBandControls : juce::Component {
+    PeakBandControls(juce::AudioProcessorValueTreeState& apvts, int peak);
+    ~PeakBandControls() override;
+
+    void resized() override;
+
+private:
+    RotarySliderWithLabels freqSlider, gainSlider, qualitySlider;
+    PowerButton bypassButton;
+
+    using Attachment = juce::AudioProcessorValueTreeState::SliderAttachment;
+    Attachment freqSliderAttachment, gainSliderAttachment, qualitySliderAttachment;
+    juce::AudioProcessorValueTreeState::ButtonAttachment bypassButtonAttachment;
+
+    juce::SharedResourcePointer<LookAndFeel> lnf;
+    void updateEnablement();
+};
+
 
 //==============================================================================
 /**
@@ -267,20 +868,15 @@ public:
     //==============================================================================
     void paint(juce::Graphics&) override;
     void resized() override;
+   #if SIMPLEEQ_TRACING
+    //ctrl/cmd + shift + T writes what the trace rings hold to a JSON file on the desktop
+    bool keyPressed(const juce::KeyPress& key) override;
+   #endif
 
 private:
     SimpleEQFromTutorialAudioProcessor& audioProcessor;
 
-    RotarySliderWithLabels peak1FreqSlider,
-        peak1GainSlider,
-        peak1QualitySlider,
-        peak2FreqSlider,
-        peak2GainSlider,
-        peak2QualitySlider,
-        peak3FreqSlider,
-        peak3GainSlider,
-        peak3QualitySlider,
-        lowCutFreqSlider,
+    RotarySliderWithLabels lowCutFreqSlider,
         highCutFreqSlider,
         lowCutSlopeSlider,
         highCutSlopeSlider;
@@ -288,32 +884,54 @@ private:
     using APVTS = juce::AudioProcessorValueTreeState;
     using Attachment = APVTS::SliderAttachment;
 
-    Attachment peak1FreqSliderAttachment,
-        peak1GainSliderAttachment,
-        peak1QualitySliderAttachment,
-        peak2FreqSliderAttachment,
-        peak2GainSliderAttachment,
-        peak2QualitySliderAttachment,
-        peak3FreqSliderAttachment,
-        peak3GainSliderAttachment,
-        peak3QualitySliderAttachment,
-        lowCutFreqSliderAttachment,
+    Attachment lowCutFreqSliderAttachment,
         highCutFreqSliderAttachment,
         lowCutSlopeSliderAttachment,
         highCutSlopeSliderAttachment;
 
-    PowerButton lowCutBypassButton, highCutBypassButton, peak1BypassButton, peak2BypassButton, peak3BypassButton;
+    PowerButton lowCutBypassButton, highCutBypassButton;
     AnalyserButton analyserEnabledButton;
+    AnalyserViewButton preEQViewButton{ "Pre" }, deltaViewButton{ "Delta" }, autoGainButton{ "Auto" };
+    //A and B light up once their snapshot is stored, clicking one stores the current settings into it
+    AnalyserViewButton storeAButton{ "A" }, storeBButton{ "B" }, morphEnabledButton{ "Morph" };
+    juce::Slider morphSlider{ juce::Slider::LinearHorizontal, juce::Slider::NoTextBox };
+    //analyser averaging, decay and peak hold, bars that show their own value
+    juce::Slider analyserAveragingSlider{ juce::Slider::LinearBar, juce::Slider::TextBoxLeft },
+                 analyserDecaySlider{ juce::Slider::LinearBar, juce::Slider::TextBoxLeft },
+                 analyserPeakHoldSlider{ juce::Slider::LinearBar, juce::Slider::TextBoxLeft };
+    //the peak count, and which of the counted peaks the knobs in the middle column belong to
+    juce::Slider peakCountSlider{ juce::Slider::IncDecButtons, juce::Slider::TextBoxLeft };
+    juce::ComboBox peakSelector;
+    std::unique_ptr<PeakBandControls> peakControls;
+    juce::Rectangle<int> peakControlsArea;
+    int shownPeak = 0;
+    void updatePeakSelector();
+    void showPeak(int peak);
 
     using ButtonAttachment = APVTS::ButtonAttachment;
-    ButtonAttachment lowCutBypassButtonAttachment, highCutBypassButtonAttachment, peak1BypassButtonAttachment, 
-                     peak2BypassButtonAttachment, peak3BypassButtonAttachment, analyserEnabledButtonAttachment;
+    ButtonAttachment lowCutBypassButtonAttachment, highCutBypassButtonAttachment, analyserEnabledButtonAttachment,
+                     morphEnabledButtonAttachment, autoGainButtonAttachment;
+    Attachment morphSliderAttachment, peakCountSliderAttachment;
+    void updateSnapshotButtons();
+
+    //Learn captures the input, Ref loads a reference file and Match fits the bands from one to the other.
+    //the file analysis and the fit run on this editor's own background thread and report back on the message
+    //thread. on the shared analyzer pool a long file would hold up every instance's analyzer frames, and with
+    //them the message thread of any editor waiting for its frame. created on first use, so opening doesn't pay for it
+    AnalyserViewButton matchLearnButton{ "Learn" }, matchReferenceButton{ "Ref" }, matchButton{ "Match" };
+    AverageSpectrum matchReference;
+    std::unique_ptr<juce::FileChooser> referenceChooser;
+    std::unique_ptr<juce::ThreadPool> matchPool;
+    juce::ThreadPool& getMatchPool();
+    void startReferenceAnalysis(const juce::File& file);
+    void startMatch();
+    void applyChainSettings(const ChainSettings& settings);
 
     std::vector<juce::Component*> getComps();
 
     ResponseCurveComponent responseCurveComponent;
 
-    LookAndFeel lnf;
+    juce::SharedResourcePointer<LookAndFeel> lnf;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SimpleEQFromTutorialAudioProcessorEditor)
 };
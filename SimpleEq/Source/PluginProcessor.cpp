@@ -9,6 +9,424 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
 
+#if SIMPLEEQ_TELEMETRY
+ #if JUCE_WINDOWS
+  #ifndef NOMINMAX
+   #define NOMINMAX
+  #endif
+  #ifndef WIN32_LEAN_AND_MEAN
+   #define WIN32_LEAN_AND_MEAN
+  #endif
+  #include <windows.h>
+ #else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+ #endif
+#endif
+
+namespace {
+    //binary state layout, all little endian:
+    //  uint32 magic 'SEQB', uint16 version, uint16 record count,
+    //  count * { uint32 parameter id hash, float plain value },
+    //  uint32 stored snapshot mask, NumSnapshots * ChainSettings as floats,
+    //  float analyser averaging ms, decay dB/s and peak hold ms,
+    //  uint32 checksum over everything before it
+    constexpr juce::uint32 binaryStateMagic = 0x42514553;
+    constexpr juce::uint16 binaryStateVersion = 1;
+    constexpr int binaryStateHeaderSize = 8;
+    constexpr int binaryStateRecordSize = 8;
+    constexpr int binaryStateChecksumSize = 4;
+    //6 cut values, 4 per peak and the peak count
+    constexpr int chainSettingsRecordSize = (6 + 4 * MaxPeakBands + 1) * 4;
+    constexpr int binaryStateSnapshotsSize = 4 + SimpleEQFromTutorialAudioProcessor::NumSnapshots * chainSettingsRecordSize;
+    constexpr int binaryStateDisplaySize = 3 * 4;
+
+    //fnv-1a, for the record ids and the checksum. unlike String::hashCode it's pinned down, so saved ids stay valid
+    juce::uint32 fnv1a(const void* data, size_t numBytes) {
+        juce::uint32 hash = 2166136261u;
+        auto bytes = static_cast<const juce::uint8*>(data);
+        for (size_t i = 0; i < numBytes; ++i) {
+            hash ^= bytes[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    void writeChainSettings(juce::OutputStream& out, const ChainSettings& s) {
+        out.writeFloat(s.lowCutFreq);
+        out.writeFloat(s.highCutFreq);
+        for (const auto& peak : s.peaks) {
+            out.writeFloat(peak.freq);
+            out.writeFloat(peak.gainInDecibels);
+            out.writeFloat(peak.quality);
+        }
+        out.writeFloat((float)s.lowCutSlope);
+        out.writeFloat((float)s.highCutSlope);
+        out.writeFloat(s.lowCutBypass ? 1.0f : 0.0f);
+        out.writeFloat(s.highCutBypass ? 1.0f : 0.0f);
+        for (const auto& peak : s.peaks)
+            out.writeFloat(peak.bypass ? 1.0f : 0.0f);
+        out.writeFloat((float)s.numPeaks);
+    }
+
+    ChainSettings readChainSettings(juce::InputStream& in) {
+        ChainSettings s;
+        s.lowCutFreq = in.readFloat();
+        s.highCutFreq = in.readFloat();
+        for (auto& peak : s.peaks) {
+            peak.freq = in.readFloat();
+            peak.gainInDecibels = in.readFloat();
+            peak.quality = in.readFloat();
+        }
+        s.lowCutSlope = juce::jlimit<int>(Slope_12, Slope_96, juce::roundToInt(in.readFloat()));
+        s.highCutSlope = juce::jlimit<int>(Slope_12, Slope_96, juce::roundToInt(in.readFloat()));
+        s.lowCutBypass = in.readFloat() > 0.5f;
+        s.highCutBypass = in.readFloat() > 0.5f;
+        for (auto& peak : s.peaks)
+            peak.bypass = in.readFloat() > 0.5f;
+        s.numPeaks = juce::jlimit(1, MaxPeakBands, juce::roundToInt(in.readFloat()));
+        return s;
+    }
+}
+
+#if SIMPLEEQ_TRACING
+std::array<TraceRecorder::Ring, TraceRecorder::MaxThreads>& TraceRecorder::getRings() {
+    //a few MB, allocated once for the process and never freed, threads may still record during shutdown
+    static auto* rings = new std::array<Ring, MaxThreads>();
+    return *rings;
+}
+
+std::atomic<juce::uint32>& TraceRecorder::getNumDropped() {
+    static std::atomic<juce::uint32> numDropped{ 0 };
+    return numDropped;
+}
+
+void TraceRecorder::prepare() {
+    getRings();
+}
+
+TraceRecorder::Ring* TraceRecorder::getRingForThisThread() {
+    //hands the ring back when the thread ends. its events stay, the next thread to claim it appends to them
+    struct Owner {
+        Ring* ring = nullptr;
+        ~Owner() {
+            if (ring != nullptr)
+                ring->inUse.store(false, std::memory_order_release);
+        }
+    };
+    thread_local Owner owner;
+
+    //a thread that found every ring taken tries again on its next event
+    if (owner.ring == nullptr) {
+        for (auto& ring : getRings()) {
+            auto expected = false;
+            if (!ring.inUse.load(std::memory_order_relaxed)
+                && ring.inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                ring.isMessageThread.store(juce::MessageManager::existsAndIsCurrentThread(), std::memory_order_relaxed);
+                owner.ring = &ring;
+                break;
+            }
+        }
+    }
+    return owner.ring;
+}
+
+void TraceRecorder::record(const char* name, juce::int64 startTicks, juce::int64 endTicks, int value) {
+    auto* ring = getRingForThisThread();
+    if (ring == nullptr) {
+        getNumDropped().fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    //seqlock style: claim the slot before touching it, so a reader that saw any part of this event knows it was lapped
+    auto index = ring->numWritten.load(std::memory_order_relaxed);
+    ring->numStarted.store(index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    auto& event = ring->events[index & (RingSize - 1)];
+    event.name.store(name, std::memory_order_relaxed);
+    event.start.store(startTicks, std::memory_order_relaxed);
+    event.end.store(endTicks, std::memory_order_relaxed);
+    event.value.store(value, std::memory_order_relaxed);
+    ring->numWritten.store(index + 1, std::memory_order_release);
+}
+
+juce::String TraceRecorder::createChromeTrace() {
+    const auto microsecondsPerTick = 1.0e6 / (double)juce::Time::getHighResolutionTicksPerSecond();
+    juce::MemoryOutputStream json;
+    json << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    auto separator = [&first, &json] {
+        if (!first)
+            json << ",\n";
+        first = false;
+    };
+
+    struct Copied { const char* name; juce::int64 start, end; int value; };
+    std::vector<Copied> copied;
+
+    for (int tid = 0; tid < MaxThreads; ++tid) {
+        auto& ring = getRings()[(size_t)tid];
+        const auto numWritten = ring.numWritten.load(std::memory_order_acquire);
+        if (numWritten == 0)
+            continue;
+
+        //a lane is a ring, so it can hold several threads one after the other. it's named after its current owner
+        separator();
+        json << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid << ",\"args\":{\"name\":\""
+             << (ring.isMessageThread.load(std::memory_order_relaxed) ? juce::String("message thread") : "thread " + juce::String(tid)) << "\"}}";
+
+        copied.clear();
+        const auto begin = numWritten > RingSize ? numWritten - RingSize : 0u;
+        for (auto i = begin; i < numWritten; ++i) {
+            const auto& event = ring.events[i & (RingSize - 1)];
+            copied.push_back({ event.name.load(std::memory_order_relaxed), event.start.load(std::memory_order_relaxed),
+                               event.end.load(std::memory_order_relaxed), event.value.load(std::memory_order_relaxed) });
+        }
+
+        //the owner kept writing while we copied, whatever it may have lapped since is dropped
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const auto numStarted = ring.numStarted.load(std::memory_order_relaxed);
+        const auto keepFrom = numStarted > RingSize ? numStarted - RingSize : 0u;
+
+        for (auto i = begin; i < numWritten; ++i) {
+            if (i < keepFrom)
+                continue;
+            const auto& event = copied[i - begin];
+            separator();
+            json << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+                 << ",\"ts\":" << juce::String(event.start * microsecondsPerTick, 3)
+                 << ",\"dur\":" << juce::String((event.end - event.start) * microsecondsPerTick, 3);
+            if (event.value >= 0)
+                json << ",\"args\":{\"value\":" << event.value << "}";
+            json << "}";
+        }
+    }
+
+    //threads that found no free ring, reported next to the events rather than silently missing from them
+    const auto numDropped = getNumDropped().load(std::memory_order_relaxed);
+    if (numDropped > 0)
+        DBG("SimpleEQ: " << (int)numDropped << " trace events dropped, more than " << MaxThreads << " threads were recording at once");
+    json << "],\"otherData\":{\"droppedEvents\":" << (int)numDropped << "}}\n";
+    return json.toString();
+}
+
+bool TraceRecorder::writeChromeTrace(const juce::File& file) {
+    return file.replaceWithText(createChromeTrace());
+}
+#endif
+
+#if SIMPLEEQ_TELEMETRY
+TelemetrySegment::TelemetrySegment() {
+   #if JUCE_WINDOWS
+    //backed by the pagefile, and zeroed when the first process creates it
+    mappingHandle = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, (DWORD)TotalSize, L"Local\\SimpleEQ Telemetry");
+    if (mappingHandle == nullptr)
+        return;
+    base = MapViewOfFile(mappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, TotalSize);
+    if (base == nullptr) {
+        unmap();
+        return;
+    }
+    VirtualLock(base, TotalSize);
+   #else
+    //per user and private to them, another user's processes can't rewrite what this one's audio threads write into
+    const auto name = "/SimpleEQ-Telemetry-" + juce::String((juce::int64)geteuid());
+    const auto fd = shm_open(name.toRawUTF8(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+        return;
+
+    //a new object is empty, zero filling it to size is an empty header and free slots. one that's already long
+    //enough is left alone, other processes are using it. one somebody else created under this name isn't used
+    struct stat info {};
+    const bool sized = fstat(fd, &info) == 0 && info.st_uid == geteuid() && (info.st_mode & 077) == 0
+                    && (info.st_size >= (off_t)TotalSize || ftruncate(fd, (off_t)TotalSize) == 0);
+    auto* mapped = sized ? mmap(nullptr, TotalSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return;
+    base = mapped;
+    //best effort, without the privilege the pages are only faulted in by claim() on the message thread
+    mlock(base, TotalSize);
+   #endif
+
+    header = static_cast<Header*>(base);
+    if (header->magic != Magic) {
+        header->magic = Magic;
+        header->version = Version;
+        header->numSlots = NumSlots;
+        header->recordSize = (juce::uint32)sizeof(TelemetryRecord);
+    }
+
+    //left by a build with another layout, don't scribble over what its monitors read
+    if (header->version != Version || header->numSlots != NumSlots || header->recordSize != sizeof(TelemetryRecord)) {
+        unmap();
+        return;
+    }
+    records = reinterpret_cast<TelemetryRecord*>(static_cast<char*>(base) + sizeof(TelemetryRecord));
+}
+
+TelemetrySegment::~TelemetrySegment() {
+    unmap();
+}
+
+//the name stays, other processes may still be publishing into it
+void TelemetrySegment::unmap() {
+    records = nullptr;
+    header = nullptr;
+   #if JUCE_WINDOWS
+    if (base != nullptr)
+        UnmapViewOfFile(base);
+    if (mappingHandle != nullptr)
+        CloseHandle(mappingHandle);
+    mappingHandle = nullptr;
+   #else
+    if (base != nullptr)
+        munmap(base, TotalSize);
+   #endif
+    base = nullptr;
+}
+
+TelemetryRecord* TelemetrySegment::claim(juce::uint32 instanceId) {
+    if (records == nullptr)
+        return nullptr;
+
+    const auto now = juce::Time::currentTimeMillis();
+    for (juce::uint32 i = 0; i < NumSlots; ++i) {
+        auto& r = records[i];
+        auto beat = r.heartbeatMs.load();
+        if ((beat != 0 && now - beat < StaleAfterMs) || !r.heartbeatMs.compare_exchange_strong(beat, now))
+            continue;
+
+        //an owner that died mid write left the sequence odd
+        r.sequence.store((r.sequence.load() + 1) & ~1u);
+        r.instanceId.store(instanceId);
+        r.blockCount = 0;
+        r.state.store(1);
+        return &r;
+    }
+    return nullptr;
+}
+
+bool TelemetrySegment::renew(TelemetryRecord* record, juce::uint32 instanceId) {
+    auto beat = record->heartbeatMs.load();
+    if (record->state.load() != 1 || record->instanceId.load() != instanceId)
+        return false;
+    //a claim that moved the heartbeat since it was read wins, and this instance is the one that lets go
+    return record->heartbeatMs.compare_exchange_strong(beat, juce::Time::currentTimeMillis());
+}
+
+void TelemetrySegment::release(TelemetryRecord* record, juce::uint32 instanceId) {
+    if (record->instanceId.load() != instanceId)
+        return;
+    record->state.store(0);
+    record->heartbeatMs.store(0);
+}
+
+bool TelemetrySegment::isMonitored() const {
+    if (header == nullptr)
+        return false;
+    const auto beat = header->monitorHeartbeatMs.load();
+    return beat != 0 && juce::Time::currentTimeMillis() - beat < StaleAfterMs;
+}
+
+//no slot yet, the first timer callback after a monitor shows up claims one
+TelemetryPublisher::TelemetryPublisher() : instanceId((juce::uint32)juce::Random::getSystemRandom().nextInt()) {
+    startTimer(1000);
+}
+
+TelemetryPublisher::~TelemetryPublisher() {
+    stopTimer();
+    if (auto* r = record.load())
+        segment->release(r, instanceId);
+}
+
+void TelemetryPublisher::timerCallback() {
+    auto* r = record.load();
+    //with nobody reading, the slot goes back and the audio thread stops publishing
+    if (!segment->isMonitored()) {
+        if (r != nullptr) {
+            record.store(nullptr);
+            segment->release(r, instanceId);
+        }
+        return;
+    }
+
+    //a message thread stalled past StaleAfterMs can find its slot taken over. stop writing into it and look for another
+    if (r != nullptr && !segment->renew(r, instanceId)) {
+        record.store(nullptr);
+        r = nullptr;
+    }
+    if (r == nullptr)
+        record.store(segment->claim(instanceId));
+}
+
+void TelemetryPublisher::prepare(double newSampleRate, int maxBlockSize) {
+    juce::ignoreUnused(maxBlockSize);
+    sampleRate = newSampleRate;
+
+    constexpr double splitFrequencies[] = { 250.0, 2000.0, 8000.0 };
+    for (size_t k = 0; k < splitCoefficients.size(); ++k) {
+        auto freq = juce::jmin(splitFrequencies[k], 0.45 * sampleRate);
+        splitCoefficients[k] = (float)(1.0 - std::exp(-juce::MathConstants<double>::twoPi * freq / sampleRate));
+    }
+    splitStates.fill(0.0f);
+}
+
+void TelemetryPublisher::publish(const juce::AudioBuffer<float>& output, int numChannels, double dspSeconds, juce::uint32 bypassMask) {
+    //the owner check narrows the window between another instance taking the slot and the next heartbeat noticing
+    auto* r = record.load(std::memory_order_acquire);
+    if (r == nullptr || sampleRate <= 0.0 || r->instanceId.load(std::memory_order_relaxed) != instanceId)
+        return;
+
+    const auto numSamples = output.getNumSamples();
+    numChannels = juce::jmin(numChannels, 2, output.getNumChannels());
+    ++blockCount;
+
+    //the bands are the steps between the lowpasses, so they add back up to the mono sum
+    std::array<double, TelemetryRecord::NumEnergyBands> energy{};
+    const auto monoGain = numChannels > 0 ? 1.0f / numChannels : 0.0f;
+    for (int i = 0; i < numSamples; ++i) {
+        float x = 0.0f;
+        for (int ch = 0; ch < numChannels; ++ch)
+            x += output.getSample(ch, i);
+        x *= monoGain;
+
+        float below = 0.0f;
+        for (size_t k = 0; k < splitStates.size(); ++k) {
+            splitStates[k] += splitCoefficients[k] * (x - splitStates[k]);
+            auto band = splitStates[k] - below;
+            energy[k] += double(band) * band;
+            below = splitStates[k];
+        }
+        energy.back() += double(x - below) * (x - below);
+    }
+    for (auto& state : splitStates)
+        juce::dsp::util::snapToZero(state);
+
+    auto sequence = r->sequence.load(std::memory_order_relaxed);
+    r->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    r->blockCount = blockCount;
+    r->sampleRate = (float)sampleRate;
+    r->blockSize = numSamples;
+    r->dspMicroseconds = (float)(dspSeconds * 1.0e6);
+    r->dspLoad = numSamples > 0 ? (float)(dspSeconds * sampleRate / numSamples) : 0.0f;
+    r->bypassMask = bypassMask;
+    for (int ch = 0; ch < 2; ++ch) {
+        auto active = ch < numChannels && numSamples > 0;
+        r->outputPeak[ch] = active ? output.getMagnitude(ch, 0, numSamples) : 0.0f;
+        r->outputRms[ch] = active ? output.getRMSLevel(ch, 0, numSamples) : 0.0f;
+    }
+    for (size_t k = 0; k < energy.size(); ++k)
+        r->bandEnergyDecibels[k] = (float)(10.0 * std::log10(juce::jmax(1.0e-20, energy[k] / juce::jmax(1, numSamples))));
+
+    r->sequence.store(sequence + 2, std::memory_order_release);
+}
+#endif
+
 //==============================================================================
 SimpleEQFromTutorialAudioProcessor::SimpleEQFromTutorialAudioProcessor()
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -16,12 +434,46 @@ SimpleEQFromTutorialAudioProcessor::SimpleEQFromTutorialAudioProcessor()
                      #if ! JucePlugin_IsMidiEffect
                       #if ! JucePlugin_IsSynth
                        .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
+                       .withInput  ("Sidechain", juce::AudioChannelSet::stereo(), false)
                       #endif
                        .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
                      #endif
                        )
 #endif
-{}
+{
+   #if SIMPLEEQ_TRACING
+    TraceRecorder::prepare();
+   #endif
+    analyserEnabled = apvts.getRawParameterValue("Analyser Enabled");
+    morphEnabled = apvts.getRawParameterValue("Morph Enabled");
+    morphPosition = apvts.getRawParameterValue("Morph");
+    autoGainEnabled = apvts.getRawParameterValue("Auto Gain");
+
+    addEqualizerBands(engine);
+
+    for (int band = 0; band < MaxPeakBands; ++band) {
+        auto prefix = getPeakParameterPrefix(band);
+        auto& params = dynamicBandParameters[band];
+        params.enabled = apvts.getRawParameterValue(prefix + "Dynamic");
+        params.sidechain = apvts.getRawParameterValue(prefix + "Sidechain");
+        params.threshold = apvts.getRawParameterValue(prefix + "Threshold");
+        params.ratio = apvts.getRawParameterValue(prefix + "Ratio");
+        params.attack = apvts.getRawParameterValue(prefix + "Attack");
+        params.release = apvts.getRawParameterValue(prefix + "Release");
+    }
+
+    for (auto* p : getParameters()) {
+        if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(p)) {
+            const auto& paramID = ranged->getParameterID();
+            auto id = fnv1a(paramID.toRawUTF8(), paramID.getNumBytesAsUTF8());
+            stateTable.push_back({ id, ranged, apvts.getRawParameterValue(paramID) });
+        }
+    }
+    std::sort(stateTable.begin(), stateTable.end(), [](const auto& a, const auto& b) { return a.id < b.id; });
+    //two parameter ids hashing to the same record id would make the state ambiguous
+    jassert(std::adjacent_find(stateTable.begin(), stateTable.end(), [](const auto& a, const auto& b) { return a.id == b.id; }) == stateTable.end());
+    restoredState.resize(stateTable.size());
+}
 
 SimpleEQFromTutorialAudioProcessor::~SimpleEQFromTutorialAudioProcessor() {}
 
@@ -89,18 +541,27 @@ void SimpleEQFromTutorialAudioProcessor::changeProgramName (int index, const juc
 
 //==============================================================================
 void SimpleEQFromTutorialAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock) {
-    juce::dsp::ProcessSpec spec;
-    spec.maximumBlockSize = samplesPerBlock;
-    spec.numChannels = 1;
-    spec.sampleRate = sampleRate;
-
-    leftChain.prepare(spec);
-    rightChain.prepare(spec);
+    engine.prepare(sampleRate);
+    autoGain.prepare(sampleRate);
+   #if SIMPLEEQ_TELEMETRY
+    telemetry.prepare(sampleRate, samplesPerBlock);
+   #endif
+    outputGain.reset(sampleRate, 0.02);
 
     updateFilters();
 
+    //safe with an editor reading them, the consumer picks the new configuration up on its next pull
     leftChannelFifo.prepare(samplesPerBlock);
     rightChannelFifo.prepare(samplesPerBlock);
+    preparedBlockSize = samplesPerBlock;
+    //the left and right analyzer channels, the sidechain is never analysed
+    preEQBuffer.setSize(2, samplesPerBlock);
+
+    detectorBuffer.setSize(2, samplesPerBlock);
+    for (auto& dynamicBand : dynamicBands) {
+        dynamicBand.prepare(sampleRate);
+        dynamicBand.reset();
+    }
 }
 
 void SimpleEQFromTutorialAudioProcessor::releaseResources()
@@ -128,6 +589,13 @@ bool SimpleEQFromTutorialAudioProcessor::isBusesLayoutSupported (const BusesLayo
    #if ! JucePlugin_IsSynth
     if (layouts.getMainOutputChannelSet() != layouts.getMainInputChannelSet())
         return false;
+
+    //the sidechain only feeds the dynamic band detectors, which sum it to mono
+    if (layouts.inputBuses.size() > 1) {
+        auto sidechain = layouts.getChannelSet(true, 1);
+        if (!sidechain.isDisabled() && sidechain != juce::AudioChannelSet::mono() && sidechain != juce::AudioChannelSet::stereo())
+            return false;
+    }
    #endif
 
     return true;
@@ -136,6 +604,10 @@ bool SimpleEQFromTutorialAudioProcessor::isBusesLayoutSupported (const BusesLayo
 #endif
 
 void SimpleEQFromTutorialAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages) {
+    SIMPLEEQ_TRACE_SCOPE("processBlock", buffer.getNumSamples());
+   #if SIMPLEEQ_TELEMETRY
+    const auto blockStartTicks = juce::Time::getHighResolutionTicks();
+   #endif
     juce::ScopedNoDenormals noDenormals;
     auto totalNumInputChannels  = getTotalNumInputChannels();
     auto totalNumOutputChannels = getTotalNumOutputChannels();
@@ -144,20 +616,77 @@ void SimpleEQFromTutorialAudioProcessor::processBlock (juce::AudioBuffer<float>&
         buffer.clear (i, 0, buffer.getNumSamples());
 
     updateFilters();
+    //from the static design, dynamic bands moving around their gain don't pull the output level with them
+    if (autoGainEnabled->load() > 0.5f) {
+        autoGain.update(engine);
+        outputGain.setTargetValue(juce::Decibels::decibelsToGain(autoGain.getGainInDecibels()));
+    }
+    else {
+        outputGain.setTargetValue(1.0f);
+    }
+
+    //149 closed editors shouldn't pay for the one that's open
+    const bool feedAnalyzer = analyzerConsumerActive.load(std::memory_order_relaxed) && analyserEnabled->load() > 0.5f;
+    const bool tapPreEQ = feedAnalyzer && preEQTapEnabled.load(std::memory_order_relaxed);
+    if (feedAnalyzer && !wasFeedingAnalyzer) {
+        leftChannelFifo.restart();
+        rightChannelFifo.restart();
+    }
+    wasFeedingAnalyzer = feedAnalyzer;
+
+    //hosts can send more than the samplesPerBlock they prepared with, the scratch buffers only hold that many.
+    //the chunks refer to the host's channels, so splitting doesn't copy or allocate
+    const auto numSamples = buffer.getNumSamples();
+    const auto maxChunkSize = juce::jmax(1, preparedBlockSize);
+    for (int start = 0; start < numSamples; start += maxChunkSize) {
+        BlockType chunk(buffer.getArrayOfWritePointers(), buffer.getNumChannels(), start, juce::jmin(maxChunkSize, numSamples - start));
+        processChunk(chunk, feedAnalyzer, tapPreEQ);
+    }
+
+   #if SIMPLEEQ_TELEMETRY
+    juce::uint32 bypassMask = (activeSettings.lowCutBypass ? 1u << LowCutBand : 0u)
+                            | (activeSettings.highCutBypass ? 1u << HighCutBand : 0u);
+    for (int i = 0; i < MaxPeakBands; ++i)
+        if (!activeSettings.isPeakActive(i))
+            bypassMask |= 1u << (FirstPeakBand + i);
+    telemetry.publish(buffer, juce::jmin(BandEngine::MaxChannels, totalNumOutputChannels), juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - blockStartTicks), bypassMask);
+   #endif
+}
+
+void SimpleEQFromTutorialAudioProcessor::processChunk(BlockType& buffer, bool feedAnalyzer, bool tapPreEQ) {
+    jassert(buffer.getNumSamples() <= preparedBlockSize);
+    const auto numSamples = buffer.getNumSamples();
+    if (tapPreEQ) {
+        const auto numPreEQChannels = juce::jmin(preEQBuffer.getNumChannels(), getMainBusNumInputChannels());
+        for (int ch = 0; ch < numPreEQChannels; ++ch)
+            preEQBuffer.copyFrom(ch, 0, buffer, ch, 0, numSamples);
+    }
 
-    juce::dsp::AudioBlock<float> block(buffer);
+    const auto numChannels = juce::jmin(BandEngine::MaxChannels, getTotalNumOutputChannels());
+    float* const* channels = buffer.getArrayOfWritePointers();
 
-    auto leftBlock = block.getSingleChannelBlock(0);
-    auto rightBlock = block.getSingleChannelBlock(1);
+    if (prepareDynamicBands(buffer)) {
+        std::array<float*, BandEngine::MaxChannels> subBlock{};
+        for (int start = 0; start < numSamples; start += DynamicSubBlockSize) {
+            auto subBlockSize = juce::jmin(DynamicSubBlockSize, numSamples - start);
+            applyDynamicGains(start, subBlockSize);
 
-    juce::dsp::ProcessContextReplacing<float> leftContext(leftBlock);
-    juce::dsp::ProcessContextReplacing<float> rightContext(rightBlock);
+            for (int ch = 0; ch < numChannels; ++ch)
+                subBlock[ch] = channels[ch] + start;
+            engine.process(subBlock.data(), numChannels, subBlockSize);
+        }
+    }
+    else {
+        engine.process(channels, numChannels, numSamples);
+    }
 
-    leftChain.process(leftContext);
-    rightChain.process(rightContext);
+    if (outputGain.isSmoothing() || outputGain.getTargetValue() != 1.0f)
+        outputGain.applyGain(buffer, numSamples);
 
-    leftChannelFifo.update(buffer);
-    rightChannelFifo.update(buffer);
+    if (feedAnalyzer) {
+        leftChannelFifo.update(buffer, tapPreEQ ? &preEQBuffer : nullptr);
+        rightChannelFifo.update(buffer, tapPreEQ ? &preEQBuffer : nullptr);
+    }
 }
 
 //==============================================================================
@@ -168,133 +697,1075 @@ bool SimpleEQFromTutorialAudioProcessor::hasEditor() const
 
 juce::AudioProcessorEditor* SimpleEQFromTutorialAudioProcessor::createEditor()
 {
+    //the whole open, members included. the first paints show up as ResponseCurveComponent::paint after it
+    SIMPLEEQ_TRACE_SCOPE("createEditor");
     return new SimpleEQFromTutorialAudioProcessorEditor(*this);
     //return new juce::GenericAudioProcessorEditor(*this);
 }
 
 //==============================================================================
 void SimpleEQFromTutorialAudioProcessor::getStateInformation (juce::MemoryBlock& destData) {
-    juce::MemoryOutputStream mos(destData, true);
-    apvts.state.writeToStream(mos);
+    juce::MemoryOutputStream mos(destData, false);
+    mos.writeInt(static_cast<int>(binaryStateMagic));
+    mos.writeShort(static_cast<short>(binaryStateVersion));
+    mos.writeShort(static_cast<short>(stateTable.size()));
+    for (const auto& slot : stateTable) {
+        mos.writeInt(static_cast<int>(slot.id));
+        mos.writeFloat(slot.value->load());
+    }
+    {
+        const juce::SpinLock::ScopedLockType lock(snapshotLock);
+        mos.writeInt((snapshotStored[SnapshotA] ? 1 : 0) | (snapshotStored[SnapshotB] ? 2 : 0));
+        for (const auto& snapshot : snapshots)
+            writeChainSettings(mos, snapshot);
+    }
+    mos.writeFloat(analyserAveragingMs.load());
+    mos.writeFloat(analyserDecayDbPerSecond.load());
+    mos.writeFloat(analyserPeakHoldMs.load());
+    mos.writeInt(static_cast<int>(fnv1a(mos.getData(), mos.getDataSize())));
 }
 
+//nothing is designed here. the audio thread owns the engine and redesigns from the parameters on its next block
 void SimpleEQFromTutorialAudioProcessor::setStateInformation (const void* data, int sizeInBytes) {
+    if (sizeInBytes >= 4 && juce::ByteOrder::littleEndianInt(data) == binaryStateMagic) {
+        readBinaryState(data, sizeInBytes);
+        return;
+    }
+
+    //sessions saved before the binary format hold the whole ValueTree
     auto tree = juce::ValueTree::readFromData(data, sizeInBytes);
     if (tree.isValid()) {
+        setSnapshots({}, {});
         apvts.replaceState(tree);
-        updateFilters();
     }
 }
 
-ChainSettings getChainSettings(juce::AudioProcessorValueTreeState& apvts) {
+bool SimpleEQFromTutorialAudioProcessor::readBinaryState(const void* data, int sizeInBytes) {
+    if (sizeInBytes < binaryStateHeaderSize + binaryStateChecksumSize)
+        return false;
+
+    juce::MemoryInputStream mis(data, static_cast<size_t>(sizeInBytes), false);
+    mis.readInt();
+    auto version = static_cast<juce::uint16>(mis.readShort());
+    auto numRecords = static_cast<int>(static_cast<juce::uint16>(mis.readShort()));
+    auto payloadSize = binaryStateHeaderSize + numRecords * binaryStateRecordSize + binaryStateSnapshotsSize + binaryStateDisplaySize;
+
+    if (version != binaryStateVersion || sizeInBytes < payloadSize + binaryStateChecksumSize) {
+        DBG("SimpleEQ: unsupported or truncated state, version " << (int)version);
+        return false;
+    }
+
+    auto checksum = juce::ByteOrder::littleEndianInt(static_cast<const char*>(data) + payloadSize);
+    if (checksum != fnv1a(data, static_cast<size_t>(payloadSize))) {
+        DBG("SimpleEQ: state checksum mismatch, ignoring it");
+        return false;
+    }
+
+    //like replaceState, parameters missing from the blob go back to their defaults
+    auto& normalised = restoredState;
+    jassert(normalised.size() == stateTable.size());
+    const auto numSlots = stateTable.size();
+    for (size_t i = 0; i < numSlots; ++i)
+        normalised[i] = stateTable[i].parameter->getDefaultValue();
+
+    const auto slotsEnd = stateTable.end();
+    for (int r = 0; r < numRecords; ++r) {
+        auto id = static_cast<juce::uint32>(mis.readInt());
+        auto value = mis.readFloat();
+        auto slot = std::lower_bound(stateTable.begin(), slotsEnd, id,
+                                     [](const StateSlot& s, juce::uint32 v) { return s.id < v; });
+        //records for parameters this build doesn't know are skipped
+        if (slot != slotsEnd && slot->id == id)
+            normalised[static_cast<size_t>(slot - stateTable.begin())] = slot->parameter->convertTo0to1(value);
+    }
+
+    std::array<ChainSettings, NumSnapshots> loadedSnapshots;
+    auto mask = mis.readInt();
+    std::array<bool, NumSnapshots> loadedStored{ (mask & 1) != 0, (mask & 2) != 0 };
+    for (auto& snapshot : loadedSnapshots)
+        snapshot = readChainSettings(mis);
+    setSnapshots(loadedSnapshots, loadedStored);
+
+    analyserAveragingMs.store(juce::jlimit(0.0f, 2000.0f, mis.readFloat()));
+    analyserDecayDbPerSecond.store(juce::jlimit(3.0f, 120.0f, mis.readFloat()));
+    analyserPeakHoldMs.store(juce::jlimit(0.0f, 10000.0f, mis.readFloat()));
+
+    //only parameters that actually move notify their listeners and the host
+    for (size_t i = 0; i < numSlots; ++i) {
+        auto* parameter = stateTable[i].parameter;
+        if (parameter->getValue() != normalised[i])
+            parameter->setValueNotifyingHost(normalised[i]);
+    }
+    return true;
+}
+
+juce::String getPeakParameterPrefix(int peak) {
+    return "Peak " + juce::String(peak + 1) + " ";
+}
+
+ChainParameterValues::ChainParameterValues(juce::AudioProcessorValueTreeState& apvts) {
+    lowCutFreq = apvts.getRawParameterValue("LowCut Freq");
+    highCutFreq = apvts.getRawParameterValue("HighCut Freq");
+    lowCutSlope = apvts.getRawParameterValue("LowCut Slope");
+    highCutSlope = apvts.getRawParameterValue("HighCut Slope");
+    lowCutBypass = apvts.getRawParameterValue("LowCut Bypass");
+    highCutBypass = apvts.getRawParameterValue("HighCut Bypass");
+    numPeaks = apvts.getRawParameterValue("Peak Count");
+
+    for (int i = 0; i < MaxPeakBands; ++i) {
+        auto prefix = getPeakParameterPrefix(i);
+        peaks[i].freq = apvts.getRawParameterValue(prefix + "Freq");
+        peaks[i].gain = apvts.getRawParameterValue(prefix + "Gain");
+        peaks[i].quality = apvts.getRawParameterValue(prefix + "Quality");
+        peaks[i].bypass = apvts.getRawParameterValue(prefix + "Bypass");
+    }
+}
+
+ChainSettings ChainParameterValues::load() const {
     ChainSettings settings;
-    settings.lowCutFreq = apvts.getRawParameterValue("LowCut Freq")->load();
-    settings.highCutFreq = apvts.getRawParameterValue("HighCut Freq")->load();
-    settings.peak1Freq = apvts.getRawParameterValue("Peak 1 Freq")->load();
-    settings.peak1GainInDecibels = apvts.getRawParameterValue("Peak 1 Gain")->load();
-    settings.peak1Quality = apvts.getRawParameterValue("Peak 1 Quality")->load();
-    settings.peak2Freq = apvts.getRawParameterValue("Peak 2 Freq")->load();
-    settings.peak2GainInDecibels = apvts.getRawParameterValue("Peak 2 Gain")->load();
-    settings.peak2Quality = apvts.getRawParameterValue("Peak 2 Quality")->load();
-    settings.peak3Freq = apvts.getRawParameterValue("Peak 3 Freq")->load();
-    settings.peak3GainInDecibels = apvts.getRawParameterValue("Peak 3 Gain")->load();
-    settings.peak3Quality = apvts.getRawParameterValue("Peak 3 Quality")->load();
-    settings.lowCutSlope = static_cast<Slope>(/*static_cast<int>*/(apvts.getRawParameterValue("LowCut Slope")->load()));
-    settings.highCutSlope = static_cast<Slope>(/*static_cast<int>*/(apvts.getRawParameterValue("HighCut Slope")->load()));
-    settings.lowCutBypass = apvts.getRawParameterValue("LowCut Bypass")->load() > 0.5f;
-    settings.highCutBypass = apvts.getRawParameterValue("HighCut Bypass")->load() > 0.5f;
-    settings.peak1Bypass = apvts.getRawParameterValue("Peak 1 Bypass")->load() > 0.5f;
-    settings.peak2Bypass = apvts.getRawParameterValue("Peak 2 Bypass")->load() > 0.5f;
-    settings.peak3Bypass = apvts.getRawParameterValue("Peak 3 Bypass")->load() > 0.5f;
+    settings.lowCutFreq = lowCutFreq->load();
+    settings.highCutFreq = highCutFreq->load();
+    settings.lowCutSlope = static_cast<Slope>(lowCutSlope->load());
+    settings.highCutSlope = static_cast<Slope>(highCutSlope->load());
+    settings.lowCutBypass = lowCutBypass->load() > 0.5f;
+    settings.highCutBypass = highCutBypass->load() > 0.5f;
+    settings.numPeaks = juce::jlimit(1, MaxPeakBands, juce::roundToInt(numPeaks->load()));
+
+    for (int i = 0; i < MaxPeakBands; ++i) {
+        settings.peaks[i].freq = peaks[i].freq->load();
+        settings.peaks[i].gainInDecibels = peaks[i].gain->load();
+        settings.peaks[i].quality = peaks[i].quality->load();
+        settings.peaks[i].bypass = peaks[i].bypass->load() > 0.5f;
+    }
     return settings;
 }
 
-Coefficients makePeak1Filter(const ChainSettings& chainSettings, double sampleRate) {
-    return juce::dsp::IIR::Coefficients<float>::makePeakFilter(sampleRate, chainSettings.peak1Freq,
-        chainSettings.peak1Quality, juce::Decibels::decibelsToGain(chainSettings.peak1GainInDecibels));
+ChainSettings getChainSettings(juce::AudioProcessorValueTreeState& apvts) {
+    return ChainParameterValues(apvts).load();
+}
+
+BiquadCoefficients makePeakBiquad(double sampleRate, float freq, float quality, float gainInDecibels) {
+    PeakGainDesigner designer;
+    designer.prepare(sampleRate, freq, quality);
+    return designer.apply(gainInDecibels);
+}
+
+namespace {
+    //b0 b1 b2 a1 a2, divided by a0
+    BiquadCoefficients normalise(double b0, double b1, double b2, double a0, double a1, double a2) {
+        auto a0Inv = 1.0 / a0;
+        return { b0 * a0Inv, b1 * a0Inv, b2 * a0Inv, a1 * a0Inv, a2 * a0Inv };
+    }
+
+    //cos on [0, pi/2] from its Taylor series, std::cos isn't constexpr
+    constexpr double taylorCos(double x) {
+        double term = 1.0, sum = 1.0;
+        for (int n = 1; n < 12; ++n) {
+            term *= -x * x / double((2 * n - 1) * (2 * n));
+            sum += term;
+        }
+        return sum;
+    }
+
+    //section Qs of every cascade a cut band can run, q[sections - 1][section]. section k of an order N
+    //Butterworth is 1 / (2 cos((2k + 1) pi / 2N)), built at compile time so only the prewarp is left at runtime
+    struct ButterworthQTable {
+        std::array<std::array<double, BandEngine::MaxCutSections>, BandEngine::MaxCutSections> q{};
+        constexpr ButterworthQTable() {
+            for (int i = 0; i < BandEngine::MaxCutSections; ++i) {
+                const auto order = (i + 1) * 2;
+                for (int k = 0; k <= i; ++k)
+                    q[i][k] = 1.0 / (2.0 * taylorCos((2 * k + 1) * juce::MathConstants<double>::pi / (2 * order)));
+            }
+        }
+    };
+    constexpr ButterworthQTable butterworthQ;
+    static_assert(butterworthQ.q[0][0] > 0.7071067 && butterworthQ.q[0][0] < 0.7071068, "second order Q is 1/sqrt(2)");
+
+    //the bilinear prewarp of a cut frequency, shared by all sections of the band
+    double butterworthPrewarp(double sampleRate, float freq) {
+        return 1.0 / std::tan(juce::MathConstants<double>::pi * freq / sampleRate);
+    }
+
+    BiquadCoefficients butterworthSection(double n, double Q, bool highPass) {
+        auto nSquared = n * n;
+        auto invQ = 1.0 / Q;
+        auto c1 = 1.0 / (1.0 + invQ * n + nSquared);
+        auto a2 = c1 * (1.0 - invQ * n + nSquared);
+
+        //high and low pass at the same cutoff share their poles, only the zeros move
+        if (highPass)
+            return normalise(c1 * nSquared, -2.0 * c1 * nSquared, c1 * nSquared, 1.0, c1 * 2.0 * (1.0 - nSquared), a2);
+        return normalise(c1, c1 * 2.0, c1, 1.0, c1 * 2.0 * (1.0 - nSquared), a2);
+    }
+}
+
+void PeakGainDesigner::prepare(double sampleRate, float freq, float quality) {
+    auto omega = juce::MathConstants<double>::twoPi * juce::jmax((double)freq, 2.0) / sampleRate;
+    alpha = std::sin(omega) / (2.0 * quality);
+    c2 = -2.0 * std::cos(omega);
+}
+
+BiquadCoefficients PeakGainDesigner::apply(float gainInDecibels) const {
+    //sqrt of the linear gain
+    auto A = std::pow(10.0, gainInDecibels / 40.0);
+    return normalise(1.0 + alpha * A, c2, 1.0 - alpha * A, 1.0 + alpha / A, c2, 1.0 - alpha / A);
+}
+
+BiquadCoefficients makeButterworthSection(double sampleRate, float freq, int order, int section, bool highPass) {
+    jassert(order % 2 == 0 && order <= BandEngine::MaxCutSections * 2 && section < order / 2);
+    return butterworthSection(butterworthPrewarp(sampleRate, freq), butterworthQ.q[order / 2 - 1][section], highPass);
+}
+
+int BandEngine::addBand(BandType type) {
+    const auto sections = type == BandType::Peak ? 1 : MaxCutSections;
+    if (numBands == MaxBands || numSectionsUsed + sections > MaxSections) {
+        jassertfalse;
+        return -1;
+    }
+
+    auto& band = bands[numBands];
+    band.type = type;
+    band.firstSection = numSectionsUsed;
+    band.numSections = sections;
+    band.numActiveSections = type == BandType::Peak ? 1 : 0;
+    band.bypassed = false;
+
+    for (int s = band.firstSection; s < band.firstSection + sections; ++s)
+        setSection(numBands, s - band.firstSection, {});
+
+    numSectionsUsed += sections;
+    return numBands++;
+}
+
+void BandEngine::prepare(double newSampleRate) {
+    sampleRate = newSampleRate;
+    reset();
+}
+
+void BandEngine::reset() {
+    for (auto& channel : z1)
+        channel.fill(0.0f);
+    for (auto& channel : z2)
+        channel.fill(0.0f);
+}
+
+void BandEngine::setPeak(int band, float freq, float quality, float gainInDecibels) {
+    jassert(bands[band].type == BandType::Peak);
+    setSection(band, 0, makePeakBiquad(sampleRate, freq, quality, gainInDecibels));
+}
+
+void BandEngine::setCut(int band, float freq, int slope) {
+    auto& b = bands[band];
+    jassert(b.type != BandType::Peak);
+    b.numActiveSections = juce::jlimit(1, b.numSections, slope + 1);
+    const auto n = butterworthPrewarp(sampleRate, freq);
+    const auto& q = butterworthQ.q[b.numActiveSections - 1];
+    for (int s = 0; s < b.numActiveSections; ++s)
+        setSection(band, s, butterworthSection(n, q[s], b.type == BandType::LowCut));
 }
 
-Coefficients makePeak2Filter(const ChainSettings& chainSettings, double sampleRate) {
-    return juce::dsp::IIR::Coefficients<float>::makePeakFilter(sampleRate, chainSettings.peak2Freq,
-        chainSettings.peak2Quality, juce::Decibels::decibelsToGain(chainSettings.peak2GainInDecibels));
+void BandEngine::setSection(int band, int section, const BiquadCoefficients& coefficients) {
+    jassert(section < bands[band].numSections);
+    const auto s = bands[band].firstSection + section;
+    b0[s] = coefficients.b0;
+    b1[s] = coefficients.b1;
+    b2[s] = coefficients.b2;
+    a1[s] = coefficients.a1;
+    a2[s] = coefficients.a2;
+}
+
+int BandEngine::getActiveSections(int band, BiquadCoefficients* dest) const {
+    const auto& b = bands[band];
+    if (b.bypassed)
+        return 0;
+
+    for (int i = 0; i < b.numActiveSections; ++i) {
+        const auto s = b.firstSection + i;
+        dest[i] = { b0[s], b1[s], b2[s], a1[s], a2[s] };
+    }
+    return b.numActiveSections;
 }
 
-Coefficients makePeak3Filter(const ChainSettings& chainSettings, double sampleRate) {
-    return juce::dsp::IIR::Coefficients<float>::makePeakFilter(sampleRate, chainSettings.peak3Freq,
-        chainSettings.peak3Quality, juce::Decibels::decibelsToGain(chainSettings.peak3GainInDecibels));
+void BandEngine::process(float* const* channels, int numChannels, int numSamples) {
+    jassert(numChannels <= MaxChannels);
+
+    for (int band = 0; band < numBands; ++band) {
+        const auto& b = bands[band];
+        if (b.bypassed)
+            continue;
+
+        SIMPLEEQ_TRACE_SCOPE(b.type == BandType::Peak ? "peak band" : b.type == BandType::LowCut ? "low cut band" : "high cut band", band);
+        for (int s = b.firstSection; s < b.firstSection + b.numActiveSections; ++s) {
+            const auto cb0 = b0[s], cb1 = b1[s], cb2 = b2[s], ca1 = a1[s], ca2 = a2[s];
+
+            for (int ch = 0; ch < numChannels; ++ch) {
+                auto* samples = channels[ch];
+                auto s1 = z1[ch][s], s2 = z2[ch][s];
+
+                for (int i = 0; i < numSamples; ++i) {
+                    double in = samples[i];
+                    auto out = cb0 * in + s1;
+                    s1 = cb1 * in - ca1 * out + s2;
+                    s2 = cb2 * in - ca2 * out;
+                    samples[i] = (float)out;
+                }
+
+                juce::dsp::util::snapToZero(s1);
+                juce::dsp::util::snapToZero(s2);
+                z1[ch][s] = s1;
+                z2[ch][s] = s2;
+            }
+        }
+    }
 }
 
-void SimpleEQFromTutorialAudioProcessor::updatePeakFilters(const ChainSettings& chainSettings) {
-    auto sampleRate = getSampleRate();
-    auto peak1Coefficients = makePeak1Filter(chainSettings, sampleRate);
-    auto peak2Coefficients = makePeak2Filter(chainSettings, sampleRate);
-    auto peak3Coefficients = makePeak3Filter(chainSettings, sampleRate);
+void addEqualizerBands(BandEngine& engine) {
+    jassert(engine.getNumBands() == 0);
+    engine.addBand(BandEngine::BandType::LowCut);
+    for (int i = 0; i < MaxPeakBands; ++i)
+        engine.addBand(BandEngine::BandType::Peak);
+    engine.addBand(BandEngine::BandType::HighCut);
+}
 
-    leftChain.setBypassed<ChainPositions::Peak1>(chainSettings.peak1Bypass);
-    rightChain.setBypassed<ChainPositions::Peak1>(chainSettings.peak1Bypass);
-    leftChain.setBypassed<ChainPositions::Peak1>(chainSettings.peak2Bypass);
-    rightChain.setBypassed<ChainPositions::Peak1>(chainSettings.peak2Bypass);
-    leftChain.setBypassed<ChainPositions::Peak1>(chainSettings.peak2Bypass);
-    rightChain.setBypassed<ChainPositions::Peak1>(chainSettings.peak2Bypass);
+void applyBandSettings(BandEngine& engine, const ChainSettings& chainSettings, int band) {
+    if (band == LowCutBand) {
+        engine.setBypassed(band, chainSettings.lowCutBypass);
+        engine.setCut(band, chainSettings.lowCutFreq, chainSettings.lowCutSlope);
+    }
+    else if (band == HighCutBand) {
+        engine.setBypassed(band, chainSettings.highCutBypass);
+        engine.setCut(band, chainSettings.highCutFreq, chainSettings.highCutSlope);
+    }
+    else {
+        //a peak past the count is bypassed and skipped, not designed
+        const auto peak = band - FirstPeakBand;
+        engine.setBypassed(band, !chainSettings.isPeakActive(peak));
+        if (!engine.isBypassed(band))
+            engine.setPeak(band, chainSettings.peaks[peak].freq, chainSettings.peaks[peak].quality, chainSettings.peaks[peak].gainInDecibels);
+    }
+}
 
-    updateCoefficients(leftChain.get<ChainPositions::Peak1>().coefficients, peak1Coefficients);
-    updateCoefficients(rightChain.get<ChainPositions::Peak1>().coefficients, peak1Coefficients);
-    updateCoefficients(leftChain.get<ChainPositions::Peak2>().coefficients, peak2Coefficients);
-    updateCoefficients(rightChain.get<ChainPositions::Peak2>().coefficients, peak2Coefficients);
-    updateCoefficients(leftChain.get<ChainPositions::Peak3>().coefficients, peak3Coefficients);
-    updateCoefficients(rightChain.get<ChainPositions::Peak3>().coefficients, peak3Coefficients);
+void DynamicBand::prepare(double newSampleRate) {
+    sampleRate = newSampleRate;
+    //force every coefficient to be recomputed
+    freq = quality = 0.0f;
+    attackMs = releaseMs = -1.0f;
 }
 
-void updateCoefficients(Coefficients& old, const Coefficients& replacements) {
-    *old = *replacements;
+void DynamicBand::reset() {
+    z1 = z2 = 0.0f;
+    envelope = 0.0f;
 }
 
-void SimpleEQFromTutorialAudioProcessor::updateLowCutFilters(const ChainSettings &chainSettings) {
-    auto lowCutCoefficients = makeLowCutFilter(chainSettings, getSampleRate());
-    auto& leftLowCut = leftChain.get<LowCut>();
-    auto& rightLowCut = rightChain.get<LowCut>();
+void DynamicBand::setParameters(float newFreq, float newQuality, float thresholdInDecibels, float ratio, float newAttackMs, float newReleaseMs) {
+    if (newFreq != freq || newQuality != quality) {
+        freq = newFreq;
+        quality = newQuality;
+        //constant 0 dB peak band pass
+        auto omega = juce::MathConstants<double>::twoPi * juce::jlimit(2.0, sampleRate * 0.49, (double)freq) / sampleRate;
+        auto alpha = std::sin(omega) / (2.0 * quality);
+        auto a0Inv = 1.0 / (1.0 + alpha);
+        b0 = (float)(alpha * a0Inv);
+        b2 = -b0;
+        a1 = (float)(-2.0 * std::cos(omega) * a0Inv);
+        a2 = (float)((1.0 - alpha) * a0Inv);
+    }
 
-    leftChain.setBypassed<ChainPositions::LowCut>(chainSettings.lowCutBypass);
-    rightChain.setBypassed<ChainPositions::LowCut>(chainSettings.lowCutBypass);
+    auto timeConstant = [this](float ms) { return (float)std::exp(-1.0 / (juce::jmax(0.01, (double)ms) * 0.001 * sampleRate)); };
+    if (newAttackMs != attackMs) {
+        attackMs = newAttackMs;
+        attackCoeff = timeConstant(attackMs);
+    }
+    if (newReleaseMs != releaseMs) {
+        releaseMs = newReleaseMs;
+        releaseCoeff = timeConstant(releaseMs);
+    }
 
-    updateCutFilter(leftLowCut, lowCutCoefficients, chainSettings.lowCutSlope);
-    updateCutFilter(rightLowCut, lowCutCoefficients, chainSettings.lowCutSlope);
+    threshold = thresholdInDecibels;
+    slope = 1.0f - 1.0f / juce::jmax(1.0f, ratio);
 }
 
-void SimpleEQFromTutorialAudioProcessor::updateHighCutFilters(const ChainSettings& chainSettings) {
-    auto highCutCoefficients = makeHighCutFilter(chainSettings, getSampleRate());
-    auto& leftHighCut = leftChain.get<HighCut>();
-    auto& rightHighCut = rightChain.get<HighCut>();
+float DynamicBand::process(const float* detectorSignal, int numSamples) {
+    for (int i = 0; i < numSamples; ++i) {
+        auto x = detectorSignal[i];
+        auto y = b0 * x + z1;
+        z1 = z2 - a1 * y;
+        z2 = b2 * x - a2 * y;
 
-    leftChain.setBypassed<ChainPositions::HighCut>(chainSettings.highCutBypass);
-    rightChain.setBypassed<ChainPositions::HighCut>(chainSettings.highCutBypass);
+        auto level = std::abs(y);
+        auto coeff = level > envelope ? attackCoeff : releaseCoeff;
+        envelope = level + coeff * (envelope - level);
+    }
 
-    updateCutFilter(leftHighCut, highCutCoefficients, chainSettings.highCutSlope);
-    updateCutFilter(rightHighCut, highCutCoefficients, chainSettings.highCutSlope);
+    auto overshoot = juce::Decibels::gainToDecibels(envelope, -100.0f) - threshold;
+    return overshoot > 0.0f ? juce::jmin(MaxReductionInDecibels, overshoot * slope) : 0.0f;
+}
+
+bool SimpleEQFromTutorialAudioProcessor::prepareDynamicBands(BlockType& buffer) {
+    bool anyActive = false;
+    bool anyUsesSidechain = false;
+    const auto sampleRate = getSampleRate();
+
+    for (int i = 0; i < MaxPeakBands; ++i) {
+        const auto& params = dynamicBandParameters[i];
+        const auto& peak = activeSettings.peaks[i];
+        dynamicBandActive[i] = params.enabled->load() > 0.5f && activeSettings.isPeakActive(i);
+        if (!dynamicBandActive[i]) {
+            dynamicBands[i].reset();
+            continue;
+        }
+
+        peakGainDesigners[i].prepare(sampleRate, peak.freq, peak.quality);
+        dynamicBands[i].setParameters(peak.freq, peak.quality, params.threshold->load(), params.ratio->load(),
+                                      params.attack->load(), params.release->load());
+        dynamicBandUsesSidechain[i] = params.sidechain->load() > 0.5f;
+        anyUsesSidechain |= dynamicBandUsesSidechain[i];
+        anyActive = true;
+    }
+
+    if (!anyActive)
+        return false;
+
+    //both detector signals are taken before the engine touches the buffer
+    const auto numSamples = buffer.getNumSamples();
+    jassert(numSamples <= detectorBuffer.getNumSamples());
+    auto sumToMono = [numSamples](const BlockType& source, float* dest) {
+        const auto numChannels = juce::jmin(2, source.getNumChannels());
+        if (numChannels == 0) {
+            juce::FloatVectorOperations::clear(dest, numSamples);
+            return;
+        }
+        const auto gain = 1.0f / numChannels;
+        juce::FloatVectorOperations::copyWithMultiply(dest, source.getReadPointer(0), gain, numSamples);
+        for (int ch = 1; ch < numChannels; ++ch)
+            juce::FloatVectorOperations::addWithMultiply(dest, source.getReadPointer(ch), gain, numSamples);
+    };
+
+    sumToMono(getBusBuffer(buffer, true, 0), detectorBuffer.getWritePointer(0));
+
+    //without a connected sidechain, those bands listen to the main input
+    const bool hasSidechain = getBusCount(true) > 1 && getChannelCountOfBus(true, 1) > 0;
+    if (anyUsesSidechain && hasSidechain)
+        sumToMono(getBusBuffer(buffer, true, 1), detectorBuffer.getWritePointer(1));
+    else
+        for (auto& usesSidechain : dynamicBandUsesSidechain)
+            usesSidechain = false;
+
+    return true;
+}
+
+void SimpleEQFromTutorialAudioProcessor::applyDynamicGains(int startSample, int numSamples) {
+    for (int i = 0; i < MaxPeakBands; ++i) {
+        if (!dynamicBandActive[i])
+            continue;
+
+        auto* detector = detectorBuffer.getReadPointer(dynamicBandUsesSidechain[i] ? 1 : 0, startSample);
+        auto reduction = dynamicBands[i].process(detector, numSamples);
+        auto gain = activeSettings.peaks[i].gainInDecibels - reduction;
+        engine.setSection(FirstPeakBand + i, 0, peakGainDesigners[i].apply(gain));
+    }
+}
+
+ChainSettings morphChainSettings(const ChainSettings& a, const ChainSettings& b, float position) {
+    auto t = juce::jlimit(0.0f, 1.0f, position);
+    auto logLerp = [t](float x, float y) { return std::exp(juce::jmap(t, std::log(juce::jmax(x, 1.0e-3f)), std::log(juce::jmax(y, 1.0e-3f)))); };
+    const auto& nearest = t < 0.5f ? a : b;
+
+    ChainSettings m;
+    m.lowCutFreq = logLerp(a.lowCutFreq, b.lowCutFreq);
+    m.highCutFreq = logLerp(a.highCutFreq, b.highCutFreq);
+    m.lowCutSlope = nearest.lowCutSlope;
+    m.highCutSlope = nearest.highCutSlope;
+    m.lowCutBypass = nearest.lowCutBypass;
+    m.highCutBypass = nearest.highCutBypass;
+    m.numPeaks = juce::jmax(a.numPeaks, b.numPeaks);
+
+    for (int i = 0; i < MaxPeakBands; ++i) {
+        const auto& pa = a.peaks[i];
+        const auto& pb = b.peaks[i];
+        const auto activeA = a.isPeakActive(i), activeB = b.isPeakActive(i);
+        auto& pm = m.peaks[i];
+        pm.freq = logLerp(pa.freq, pb.freq);
+        pm.quality = logLerp(pa.quality, pb.quality);
+        pm.gainInDecibels = juce::jmap(t, activeA ? pa.gainInDecibels : 0.0f, activeB ? pb.gainInDecibels : 0.0f);
+        pm.bypass = !activeA && !activeB;
+    }
+    return m;
+}
+
+void SimpleEQFromTutorialAudioProcessor::storeSnapshot(int snapshot) {
+    jassert(snapshot >= 0 && snapshot < NumSnapshots);
+    std::array<ChainSettings, NumSnapshots> newSnapshots;
+    std::array<bool, NumSnapshots> stored;
+    {
+        const juce::SpinLock::ScopedLockType lock(snapshotLock);
+        newSnapshots = snapshots;
+        stored = snapshotStored;
+    }
+    newSnapshots[snapshot] = chainParameters.load();
+    stored[snapshot] = true;
+    setSnapshots(newSnapshots, stored);
+}
+
+bool SimpleEQFromTutorialAudioProcessor::hasSnapshot(int snapshot) const {
+    const juce::SpinLock::ScopedLockType lock(snapshotLock);
+    return snapshotStored[snapshot];
+}
+
+void SimpleEQFromTutorialAudioProcessor::setSnapshots(const std::array<ChainSettings, NumSnapshots>& newSnapshots,
+                                                      const std::array<bool, NumSnapshots>& stored) {
+    {
+        const juce::SpinLock::ScopedLockType lock(snapshotLock);
+        snapshots = newSnapshots;
+        snapshotStored = stored;
+    }
+    snapshotGeneration.fetch_add(1, std::memory_order_release);
+}
+
+ChainSettings SimpleEQFromTutorialAudioProcessor::getEffectiveChainSettings() {
+    if (morphEnabled->load() > 0.5f) {
+        const juce::SpinLock::ScopedLockType lock(snapshotLock);
+        if (snapshotStored[SnapshotA] && snapshotStored[SnapshotB])
+            return morphChainSettings(snapshots[SnapshotA], snapshots[SnapshotB], morphPosition->load());
+    }
+    return chainParameters.load();
+}
+
+bool SimpleEQFromTutorialAudioProcessor::updateMorphedFilters() {
+    if (morphEnabled->load() < 0.5f)
+        return false;
+
+    auto generation = snapshotGeneration.load(std::memory_order_acquire);
+    if (generation != morphEndpointsGeneration) {
+        //if the message thread holds the lock, keep the old endpoints for another block
+        const juce::SpinLock::ScopedTryLockType lock(snapshotLock);
+        if (lock.isLocked()) {
+            morphEndpoints = snapshots;
+            morphEndpointsValid = snapshotStored[SnapshotA] && snapshotStored[SnapshotB];
+            morphEndpointsGeneration = generation;
+        }
+    }
+    if (!morphEndpointsValid)
+        return false;
+
+    activeSettings = morphChainSettings(morphEndpoints[SnapshotA], morphEndpoints[SnapshotB], morphPosition->load());
+    return true;
+}
+
+void BiquadMagnitudeEvaluator::prepare(int numPoints, double newSampleRate, double minFreq, double maxFreq) {
+    sampleRate = newSampleRate;
+    frequencies.resize(numPoints);
+
+    const auto numRegisters = (numPoints + NumLanes - 1) / NumLanes;
+    phi.assign(numRegisters, Register::expand(0.0));
+    numerator.resize(numRegisters);
+    denominator.resize(numRegisters);
+
+    for (int i = 0; i < numPoints; ++i) {
+        auto freq = juce::mapToLog10(double(i) / double(numPoints), minFreq, maxFreq);
+        auto halfOmegaSin = std::sin(juce::MathConstants<double>::pi * freq / sampleRate);
+        frequencies[i] = freq;
+        phi[i / NumLanes].set(i % NumLanes, halfOmegaSin * halfOmegaSin);
+    }
+}
+
+void BiquadMagnitudeEvaluator::evaluate(const BiquadCoefficients* sections, int numSections, float* magnitudesInDecibels) {
+    const auto numRegisters = phi.size();
+    std::fill(numerator.begin(), numerator.end(), Register::expand(1.0));
+    std::fill(denominator.begin(), denominator.end(), Register::expand(1.0));
+
+    //(c0 + c1 + c2)^2 - 4 (c0 c1 + 4 c0 c2 + c1 c2) phi + 16 c0 c2 phi^2, for both polynomials
+    auto accumulate = [this, numRegisters](std::vector<Register>& product, double c0, double c1, double c2) {
+        auto constant = Register::expand((c0 + c1 + c2) * (c0 + c1 + c2));
+        auto linear = Register::expand(-4.0 * (c0 * c1 + 4.0 * c0 * c2 + c1 * c2));
+        auto quadratic = Register::expand(16.0 * c0 * c2);
+
+        for (size_t r = 0; r < numRegisters; ++r)
+            product[r] *= Register::multiplyAdd(constant, phi[r], Register::multiplyAdd(linear, phi[r], quadratic));
+    };
+
+    for (int s = 0; s < numSections; ++s) {
+        const auto& c = sections[s];
+        accumulate(numerator, c.b0, c.b1, c.b2);
+        accumulate(denominator, 1.0, c.a1, c.a2);
+    }
+
+    for (int i = 0; i < getNumPoints(); ++i) {
+        auto n = juce::jmax(numerator[i / NumLanes].get(i % NumLanes), 1.0e-30);
+        auto d = juce::jmax(denominator[i / NumLanes].get(i % NumLanes), 1.0e-30);
+        magnitudesInDecibels[i] = (float)juce::jmax(-300.0, 10.0 * std::log10(n / d));
+    }
 }
 
 void SimpleEQFromTutorialAudioProcessor::updateFilters() {
-    auto chainSettings = getChainSettings(apvts);
-    updateLowCutFilters(chainSettings);
-    updatePeakFilters(chainSettings);
-    updateHighCutFilters(chainSettings);
+    SIMPLEEQ_TRACE_SCOPE("updateFilters");
+    if (!updateMorphedFilters())
+        activeSettings = chainParameters.load();
+
+    for (int band = 0; band < NumBands; ++band)
+        applyBandSettings(engine, activeSettings, band);
+}
+
+void AutoGainCompensation::prepare(double sampleRate) {
+    grid.prepare(NumPoints, sampleRate);
+
+    //IEC 61672 A-weighting as a power ratio, normalised to 1 at 1kHz
+    auto aWeighting = [](double f) {
+        const auto f2 = f * f;
+        const auto ra = (148693636.0 * f2 * f2)
+                      / ((f2 + 424.36) * std::sqrt((f2 + 11599.29) * (f2 + 544496.41)) * (f2 + 148693636.0));
+        return ra * ra;
+    };
+    const auto reference = aWeighting(1000.0);
+    for (int p = 0; p < NumPoints; ++p)
+        weights[p] = (float)(aWeighting(grid.getFrequency(p)) / reference);
+
+    bandNumSections.fill(-1);
+    gainInDecibels = 0.0f;
+}
+
+bool AutoGainCompensation::update(const BandEngine& engine) {
+    bool changed = false;
+    std::array<BiquadCoefficients, BandEngine::MaxCutSections> sections;
+
+    for (int band = 0; band < NumBands; ++band) {
+        auto numSections = engine.getActiveSections(band, sections.data());
+        auto& cached = bandSections[band];
+        bool same = numSections == bandNumSections[band];
+        for (int s = 0; same && s < numSections; ++s) {
+            same = sections[s].b0 == cached[s].b0 && sections[s].b1 == cached[s].b1 && sections[s].b2 == cached[s].b2
+                && sections[s].a1 == cached[s].a1 && sections[s].a2 == cached[s].a2;
+        }
+        if (same)
+            continue;
+
+        std::copy(sections.begin(), sections.begin() + numSections, cached.begin());
+        bandNumSections[band] = numSections;
+        grid.evaluate(sections.data(), numSections, bandMagnitudes[band].data());
+        changed = true;
+    }
+    if (!changed)
+        return false;
+
+    double weightedPower = 0.0, weightSum = 0.0;
+    for (int p = 0; p < NumPoints; ++p) {
+        float decibels = 0.0f;
+        for (const auto& magnitudes : bandMagnitudes)
+            decibels += magnitudes[p];
+        weightedPower += weights[p] * std::pow(10.0, decibels * 0.1);
+        weightSum += weights[p];
+    }
+
+    auto newGain = (float)juce::jlimit<double>(-MaxGainInDecibels, MaxGainInDecibels,
+                                               -10.0 * std::log10(juce::jmax(weightedPower / weightSum, 1.0e-30)));
+    if (newGain == gainInDecibels)
+        return false;
+    gainInDecibels = newGain;
+    return true;
+}
+
+void AverageSpectrum::merge(const AverageSpectrum& other) {
+    if (other.isEmpty())
+        return;
+    if (isEmpty()) {
+        *this = other;
+        return;
+    }
+
+    jassert(other.fftSize == fftSize);
+    for (size_t k = 0; k < powerSums.size(); ++k)
+        powerSums[k] += other.powerSums[k];
+    numFrames += other.numFrames;
+}
+
+double AverageSpectrum::getSmoothedDecibels(double freq, double octaveFraction) const {
+    if (isEmpty() || fftSize == 0)
+        return -300.0;
+
+    const auto binWidth = sampleRate / fftSize;
+    const auto lastBin = (int)powerSums.size() - 1;
+    const auto halfBand = std::pow(2.0, octaveFraction * 0.5);
+    const auto firstBin = juce::jlimit(0, lastBin, (int)std::ceil(freq / halfBand / binWidth));
+    const auto endBin = juce::jlimit(0, lastBin, (int)std::floor(freq * halfBand / binWidth));
+
+    double power = 0.0;
+    if (endBin < firstBin) {
+        //narrower than a bin, interpolate between the two around it
+        auto position = juce::jlimit(0.0, double(lastBin - 1), freq / binWidth);
+        auto bin = (int)position;
+        power = juce::jmap(position - bin, powerSums[bin], powerSums[bin + 1]);
+    }
+    else {
+        for (int k = firstBin; k <= endBin; ++k)
+            power += powerSums[k];
+        power /= endBin - firstBin + 1;
+    }
+    return 10.0 * std::log10(juce::jmax(1.0e-30, power / numFrames));
+}
+
+void WelchAnalyser::prepare(double sampleRate, int fftOrder) {
+    fft = std::make_unique<juce::dsp::FFT>(fftOrder);
+    const auto size = fft->getSize();
+
+    window.resize(size);
+    for (int n = 0; n < size; ++n)
+        window[n] = 0.5f - 0.5f * std::cos(juce::MathConstants<float>::twoPi * n / size);
+    ring.assign(size, 0.0f);
+    fftData.assign(size * 2, 0.0f);
+
+    spectrum.sampleRate = sampleRate;
+    spectrum.fftSize = size;
+    reset();
+}
+
+void WelchAnalyser::reset() {
+    std::fill(ring.begin(), ring.end(), 0.0f);
+    spectrum.powerSums.assign(spectrum.fftSize / 2 + 1, 0.0);
+    spectrum.numFrames = 0;
+    writePos = 0;
+    //the first frame waits for a full ring
+    samplesUntilFrame = spectrum.fftSize;
+}
+
+void WelchAnalyser::push(const float* samples, int numSamples) {
+    jassert(fft != nullptr);
+    const auto size = spectrum.fftSize;
+
+    for (int i = 0; i < numSamples;) {
+        auto num = juce::jmin(numSamples - i, samplesUntilFrame);
+        for (int n = 0; n < num; ++n) {
+            ring[writePos] = samples[i + n];
+            writePos = (writePos + 1) & (size - 1);
+        }
+        i += num;
+        samplesUntilFrame -= num;
+
+        if (samplesUntilFrame == 0) {
+            //oldest sample sits at the write position
+            std::copy(ring.begin() + writePos, ring.end(), fftData.begin());
+            std::copy(ring.begin(), ring.begin() + writePos, fftData.begin() + (size - writePos));
+            juce::FloatVectorOperations::multiply(fftData.data(), window.data(), size);
+            fft->performFrequencyOnlyForwardTransform(fftData.data());
+
+            for (size_t k = 0; k < spectrum.powerSums.size(); ++k)
+                spectrum.powerSums[k] += double(fftData[k]) * fftData[k];
+            ++spectrum.numFrames;
+            samplesUntilFrame = size / 2;
+        }
+    }
+}
+
+bool analyseAudioFile(const juce::File& file, WelchAnalyser& analyser, const std::function<bool()>& shouldStop) {
+    juce::AudioFormatManager formats;
+    formats.registerBasicFormats();
+    std::unique_ptr<juce::AudioFormatReader> reader(formats.createReaderFor(file));
+    if (reader == nullptr || reader->sampleRate <= 0.0 || reader->numChannels == 0)
+        return false;
+
+    analyser.prepare(reader->sampleRate);
+
+    constexpr int blockSize = 8192;
+    const auto numChannels = (int)juce::jmin(2u, reader->numChannels);
+    juce::AudioBuffer<float> buffer(numChannels, blockSize);
+    std::vector<float> mono(blockSize);
+
+    for (juce::int64 position = 0; position < reader->lengthInSamples; position += blockSize) {
+        if (shouldStop())
+            return false;
+
+        auto numSamples = (int)juce::jmin((juce::int64)blockSize, reader->lengthInSamples - position);
+        reader->read(&buffer, 0, numSamples, position, true, true);
+
+        const auto gain = 1.0f / numChannels;
+        juce::FloatVectorOperations::copyWithMultiply(mono.data(), buffer.getReadPointer(0), gain, numSamples);
+        for (int ch = 1; ch < numChannels; ++ch)
+            juce::FloatVectorOperations::addWithMultiply(mono.data(), buffer.getReadPointer(ch), gain, numSamples);
+        analyser.push(mono.data(), numSamples);
+    }
+    return !analyser.getSpectrum().isEmpty();
+}
+
+namespace {
+    //log frequencies and Qs so steps are relative, gains in dB: both cut frequencies, then freq, gain and Q per peak.
+    //only the first 2 + 3 * numPeaks take part, the rest stay zero and get pinned like a bypassed cut
+    constexpr int NumFitParameters = 2 + 3 * MaxPeakBands;
+    int getNumFitParameters(const ChainSettings& s) { return 2 + 3 * s.numPeaks; }
+    using FitParameters = std::array<double, NumFitParameters>;
+
+    int getBandOfFitParameter(int parameter) {
+        if (parameter == 0)
+            return LowCutBand;
+        if (parameter == 1)
+            return HighCutBand;
+        return FirstPeakBand + (parameter - 2) / 3;
+    }
+
+    //clamped to the parameter ranges, so a step out of range just stops moving
+    ChainSettings toChainSettings(const ChainSettings& base, const FitParameters& x) {
+        auto s = base;
+        s.lowCutFreq = (float)juce::jlimit(20.0, 20000.0, std::exp(x[0]));
+        s.highCutFreq = (float)juce::jlimit(20.0, 20000.0, std::exp(x[1]));
+        for (int i = 0; i < s.numPeaks; ++i) {
+            auto& peak = s.peaks[i];
+            peak.freq = (float)juce::jlimit(20.0, 20000.0, std::exp(x[2 + 3 * i]));
+            peak.gainInDecibels = (float)juce::jlimit(-24.0, 24.0, x[3 + 3 * i]);
+            peak.quality = (float)juce::jlimit(0.1, 10.0, std::exp(x[4 + 3 * i]));
+            peak.bypass = false;
+        }
+        return s;
+    }
+
+    FitParameters toFitParameters(const ChainSettings& s) {
+        FitParameters x{};
+        x[0] = std::log(s.lowCutFreq);
+        x[1] = std::log(s.highCutFreq);
+        for (int i = 0; i < s.numPeaks; ++i) {
+            x[2 + 3 * i] = std::log(s.peaks[i].freq);
+            x[3 + 3 * i] = s.peaks[i].gainInDecibels;
+            x[4 + 3 * i] = std::log(s.peaks[i].quality);
+        }
+        return x;
+    }
+
+    //a x = b by Gaussian elimination with partial pivoting, the solution replaces b. false when singular
+    template <size_t N>
+    bool solveLinearSystem(std::array<std::array<double, N>, N>& a, std::array<double, N>& b) {
+        for (size_t col = 0; col < N; ++col) {
+            auto pivot = col;
+            for (auto row = col + 1; row < N; ++row)
+                if (std::abs(a[row][col]) > std::abs(a[pivot][col]))
+                    pivot = row;
+            if (std::abs(a[pivot][col]) < 1.0e-12)
+                return false;
+
+            std::swap(a[col], a[pivot]);
+            std::swap(b[col], b[pivot]);
+            for (auto row = col + 1; row < N; ++row) {
+                auto factor = a[row][col] / a[col][col];
+                for (auto c = col; c < N; ++c)
+                    a[row][c] -= factor * a[col][c];
+                b[row] -= factor * b[col];
+            }
+        }
+        for (auto col = N; col-- > 0;) {
+            for (auto c = col + 1; c < N; ++c)
+                b[col] -= a[col][c] * b[c];
+            b[col] /= a[col][col];
+        }
+        return true;
+    }
+}
+
+ChainSettings fitChainSettings(BiquadMagnitudeEvaluator& grid, const ChainSettings& start, const float* targetDecibels, const float* weights) {
+    const auto numPoints = grid.getNumPoints();
+    BandEngine engine;
+    addEqualizerBands(engine);
+    engine.prepare(grid.getSampleRate());
+
+    std::array<BiquadCoefficients, BandEngine::MaxCutSections> sections;
+    auto evaluateBand = [&](const ChainSettings& s, int band, float* dest) {
+        applyBandSettings(engine, s, band);
+        grid.evaluate(sections.data(), engine.getActiveSections(band, sections.data()), dest);
+    };
+
+    using BandMagnitudes = std::array<std::vector<float>, NumBands>;
+    BandMagnitudes bandMagnitudes, trialMagnitudes;
+    for (auto* set : { &bandMagnitudes, &trialMagnitudes })
+        for (auto& mags : *set)
+            mags.assign(numPoints, 0.0f);
+    std::vector<float> model(numPoints), trial(numPoints), shifted(numPoints);
+
+    //bands are in dB, so the cascade is their sum
+    auto sumBands = [numPoints](const BandMagnitudes& bands, std::vector<float>& dest) {
+        juce::FloatVectorOperations::copy(dest.data(), bands[0].data(), numPoints);
+        for (int band = 1; band < NumBands; ++band)
+            juce::FloatVectorOperations::add(dest.data(), bands[band].data(), numPoints);
+    };
+    auto cost = [=](const std::vector<float>& m) {
+        double sum = 0.0;
+        for (int p = 0; p < numPoints; ++p) {
+            double d = m[p] - targetDecibels[p];
+            sum += weights[p] * d * d;
+        }
+        return sum;
+    };
+
+    //flat peaks first, then each one goes where the remaining error is largest
+    auto settings = start;
+    for (auto& peak : settings.peaks) {
+        peak.gainInDecibels = 0.0f;
+        peak.bypass = false;
+    }
+    for (int band = 0; band < NumBands; ++band)
+        evaluateBand(settings, band, bandMagnitudes[band].data());
+    sumBands(bandMagnitudes, model);
+
+    for (int i = 0; i < settings.numPeaks; ++i) {
+        int worst = 0;
+        for (int p = 1; p < numPoints; ++p)
+            if (weights[p] * std::abs(targetDecibels[p] - model[p]) > weights[worst] * std::abs(targetDecibels[worst] - model[worst]))
+                worst = p;
+
+        auto& peak = settings.peaks[i];
+        peak.freq = (float)grid.getFrequency(worst);
+        peak.gainInDecibels = juce::jlimit(-24.0f, 24.0f, targetDecibels[worst] - model[worst]);
+        peak.quality = 1.0f;
+        evaluateBand(settings, FirstPeakBand + i, bandMagnitudes[FirstPeakBand + i].data());
+        sumBands(bandMagnitudes, model);
+    }
+
+    //Levenberg-Marquardt on the weighted squared error, with a forward difference Jacobian. a parameter only
+    //moves its own band, so each column costs one band evaluation
+    auto x = toFitParameters(settings);
+    auto currentCost = cost(model);
+    double lambda = 1.0e-2;
+    const auto numFitParameters = getNumFitParameters(settings);
+    std::vector<FitParameters> jacobian(numPoints);
+
+    for (int iteration = 0; iteration < 100; ++iteration) {
+        for (int j = 0; j < numFitParameters; ++j) {
+            const auto step = (j >= 2 && (j - 2) % 3 == 1) ? 1.0e-2 : 1.0e-3;
+            auto shiftedX = x;
+            shiftedX[j] += step;
+            const auto band = getBandOfFitParameter(j);
+            evaluateBand(toChainSettings(settings, shiftedX), band, shifted.data());
+            for (int p = 0; p < numPoints; ++p)
+                jacobian[p][j] = (shifted[p] - bandMagnitudes[band][p]) / step;
+        }
+
+        std::array<std::array<double, NumFitParameters>, NumFitParameters> normal{};
+        FitParameters gradient{};
+        for (int p = 0; p < numPoints; ++p) {
+            if (weights[p] <= 0.0f)
+                continue;
+            const auto residual = targetDecibels[p] - model[p];
+            for (int r = 0; r < numFitParameters; ++r) {
+                gradient[r] += weights[p] * jacobian[p][r] * residual;
+                for (int c = 0; c < numFitParameters; ++c)
+                    normal[r][c] += weights[p] * jacobian[p][r] * jacobian[p][c];
+            }
+        }
+
+        bool accepted = false;
+        double previousCost = currentCost;
+        for (int attempt = 0; attempt < 10 && !accepted; ++attempt) {
+            auto damped = normal;
+            //a bypassed cut or a peak past the count has no effect on the curve, pin it rather than let the system go singular
+            for (int d = 0; d < NumFitParameters; ++d)
+                damped[d][d] = normal[d][d] > 0.0 ? normal[d][d] * (1.0 + lambda) : 1.0;
+            auto delta = gradient;
+            if (!solveLinearSystem(damped, delta)) {
+                lambda *= 10.0;
+                continue;
+            }
+
+            auto trialX = x;
+            for (int j = 0; j < numFitParameters; ++j)
+                trialX[j] += delta[j];
+            auto trialSettings = toChainSettings(settings, trialX);
+            for (int band = 0; band < NumBands; ++band)
+                evaluateBand(trialSettings, band, trialMagnitudes[band].data());
+            sumBands(trialMagnitudes, trial);
+
+            auto trialCost = cost(trial);
+            if (trialCost < currentCost) {
+                //back from the clamped settings, so x never wanders outside the parameter ranges
+                x = toFitParameters(trialSettings);
+                std::swap(bandMagnitudes, trialMagnitudes);
+                std::swap(model, trial);
+                currentCost = trialCost;
+                lambda = juce::jmax(lambda / 3.0, 1.0e-7);
+                accepted = true;
+            }
+            else {
+                lambda *= 4.0;
+            }
+        }
+
+        if (!accepted || previousCost - currentCost < 1.0e-6 * previousCost)
+            break;
+    }
+
+    return toChainSettings(settings, x);
+}
+
+bool fitMatchEQ(const AverageSpectrum& input, const AverageSpectrum& reference, double sampleRate,
+                const ChainSettings& start, ChainSettings& result) {
+    if (input.isEmpty() || reference.isEmpty())
+        return false;
+
+    //1/6 octave smoothing, and bins more than 60 dB under a spectrum's peak are left out of the fit
+    constexpr int numPoints = 128;
+    constexpr double smoothing = 1.0 / 6.0;
+    constexpr double floorBelowPeak = 60.0;
+
+    BiquadMagnitudeEvaluator grid;
+    grid.prepare(numPoints, sampleRate > 0.0 ? sampleRate : 48000.0);
+    const auto highestUsable = 0.45 * juce::jmin(input.sampleRate, reference.sampleRate, grid.getSampleRate());
+
+    std::vector<double> inputDecibels(numPoints), referenceDecibels(numPoints);
+    for (int p = 0; p < numPoints; ++p) {
+        inputDecibels[p] = input.getSmoothedDecibels(grid.getFrequency(p), smoothing);
+        referenceDecibels[p] = reference.getSmoothedDecibels(grid.getFrequency(p), smoothing);
+    }
+    const auto inputPeak = *std::max_element(inputDecibels.begin(), inputDecibels.end());
+    const auto referencePeak = *std::max_element(referenceDecibels.begin(), referenceDecibels.end());
+
+    std::vector<float> target(numPoints), weights(numPoints);
+    double weightSum = 0.0, levelSum = 0.0;
+    for (int p = 0; p < numPoints; ++p) {
+        const bool usable = grid.getFrequency(p) < highestUsable
+                         && inputDecibels[p] > inputPeak - floorBelowPeak
+                         && referenceDecibels[p] > referencePeak - floorBelowPeak;
+        weights[p] = usable ? 1.0f : 0.0f;
+        target[p] = (float)(referenceDecibels[p] - inputDecibels[p]);
+        weightSum += weights[p];
+        levelSum += weights[p] * target[p];
+    }
+    if (weightSum < numPoints / 8)
+        return false;
+
+    const auto level = (float)(levelSum / weightSum);
+    for (auto& t : target)
+        t = juce::jlimit(-24.0f, 24.0f, t - level);
+
+    result = fitChainSettings(grid, start, target.data(), weights.data());
+    return true;
+}
+
+namespace {
+    void addPeakParameters(juce::AudioProcessorValueTreeState::ParameterLayout& layout, int peak) {
+        auto prefix = getPeakParameterPrefix(peak);
+        layout.add(std::make_unique<juce::AudioParameterFloat>(prefix + "Freq", prefix + "Freq", logRange<float>(20.0f, 20000.0f), 750.0f));
+        layout.add(std::make_unique<juce::AudioParameterFloat>(prefix + "Gain", prefix + "Gain", juce::NormalisableRange<float>(-24.0f, 24.0f, 0.5f, 1.0f), 0.0f));
+        layout.add(std::make_unique<juce::AudioParameterFloat>(prefix + "Quality", prefix + "Quality", juce::NormalisableRange<float>(0.1f, 10.0f, 0.05f, 1.0f), 1.0f));
+    }
+
+    void addPeakBypassParameter(juce::AudioProcessorValueTreeState::ParameterLayout& layout, int peak) {
+        layout.add(std::make_unique<juce::AudioParameterBool>(getPeakParameterPrefix(peak) + "Bypass", getPeakParameterPrefix(peak) + "Bypass", false));
+    }
+
+    void addDynamicBandParameters(juce::AudioProcessorValueTreeState::ParameterLayout& layout, int peak) {
+        auto prefix = getPeakParameterPrefix(peak);
+        layout.add(std::make_unique<juce::AudioParameterBool>(prefix + "Dynamic", prefix + "Dynamic", false));
+        layout.add(std::make_unique<juce::AudioParameterBool>(prefix + "Sidechain", prefix + "Sidechain", false));
+        layout.add(std::make_unique<juce::AudioParameterFloat>(prefix + "Threshold", prefix + "Threshold", juce::NormalisableRange<float>(-60.0f, 0.0f, 0.5f, 1.0f), -20.0f));
+        layout.add(std::make_unique<juce::AudioParameterFloat>(prefix + "Ratio", prefix + "Ratio", juce::NormalisableRange<float>(1.0f, 20.0f, 0.1f, 0.5f), 2.0f));
+        layout.add(std::make_unique<juce::AudioParameterFloat>(prefix + "Attack", prefix + "Attack", juce::NormalisableRange<float>(0.1f, 200.0f, 0.1f, 0.4f), 10.0f));
+        layout.add(std::make_unique<juce::AudioParameterFloat>(prefix + "Release", prefix + "Release", juce::NormalisableRange<float>(5.0f, 2000.0f, 1.0f, 0.4f), 150.0f));
+    }
 }
 
 juce::AudioProcessorValueTreeState::ParameterLayout SimpleEQFromTutorialAudioProcessor::createParameterLayout() {
     juce::AudioProcessorValueTreeState::ParameterLayout layout;
     layout.add(std::make_unique<juce::AudioParameterFloat>("LowCut Freq", "LowCut Freq", logRange<float>(20.0f, 20000.0f), 20.0f));
     layout.add(std::make_unique<juce::AudioParameterFloat>("HighCut Freq", "HighCut Freq", logRange<float>(20.0f, 20000.0f), 20000.0f));
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak 1 Freq", "Peak 1 Freq", logRange<float>(20.0f, 20000.0f), 750.0f));
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak 1 Gain", "Peak 1 Gain", juce::NormalisableRange<float>(-24.0f, 24.0f, 0.5f, 1.0f), 0.0f));
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak 1 Quality", "Peak 1 Quality", juce::NormalisableRange<float>(0.1f, 10.0f, 0.05f, 1.0f), 1.0f));
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak 2 Freq", "Peak 2 Freq", logRange<float>(20.0f, 20000.0f), 750.0f));
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak 2 Gain", "Peak 2 Gain", juce::NormalisableRange<float>(-24.0f, 24.0f, 0.5f, 1.0f), 0.0f));
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak 2 Quality", "Peak 2 Quality", juce::NormalisableRange<float>(0.1f, 10.0f, 0.05f, 1.0f), 1.0f));
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak 3 Freq", "Peak 3 Freq", logRange<float>(20.0f, 20000.0f), 750.0f));
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak 3 Gain", "Peak 3 Gain", juce::NormalisableRange<float>(-24.0f, 24.0f, 0.5f, 1.0f), 0.0f));
-    layout.add(std::make_unique<juce::AudioParameterFloat>("Peak 3 Quality", "Peak 3 Quality", juce::NormalisableRange<float>(0.1f, 10.0f, 0.05f, 1.0f), 1.0f));
+    //the first DefaultNumPeakBands peaks keep the places they had before the count existed, hosts index parameters
+    for (int peak = 0; peak < DefaultNumPeakBands; ++peak)
+        addPeakParameters(layout, peak);
     juce::StringArray stringArray;
-    for (int i = 0; i < 4; ++i){
+    for (int i = Slope_12; i <= Slope_96; ++i){
         juce::String str;
         str << (12 + i * 12);
         str << " db/Oct";
@@ -304,10 +1775,21 @@ juce::AudioProcessorValueTreeState::ParameterLayout SimpleEQFromTutorialAudioPro
     layout.add(std::make_unique<juce::AudioParameterChoice>("HighCut Slope", "HighCutSlope", stringArray, 0));
     layout.add(std::make_unique<juce::AudioParameterBool>("LowCut Bypass", "LowCut Bypass", false));
     layout.add(std::make_unique<juce::AudioParameterBool>("HighCut Bypass", "HighCut Bypass", false));
-    layout.add(std::make_unique<juce::AudioParameterBool>("Peak 1 Bypass", "Peak 1 Bypass", false));
-    layout.add(std::make_unique<juce::AudioParameterBool>("Peak 2 Bypass", "Peak 2 Bypass", false));
-    layout.add(std::make_unique<juce::AudioParameterBool>("Peak 3 Bypass", "Peak 3 Bypass", false));
+    for (int peak = 0; peak < DefaultNumPeakBands; ++peak)
+        addPeakBypassParameter(layout, peak);
     layout.add(std::make_unique<juce::AudioParameterBool>("Analyser Enabled", "Analyser Enabled", true));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("Morph", "Morph", juce::NormalisableRange<float>(0.0f, 1.0f), 0.0f));
+    layout.add(std::make_unique<juce::AudioParameterBool>("Morph Enabled", "Morph Enabled", false));
+    layout.add(std::make_unique<juce::AudioParameterBool>("Auto Gain", "Auto Gain", false));
+    for (int peak = 0; peak < DefaultNumPeakBands; ++peak)
+        addDynamicBandParameters(layout, peak);
+    //peaks past the default are appended as a whole, a session from before the count loads them at their defaults
+    layout.add(std::make_unique<juce::AudioParameterInt>("Peak Count", "Peak Count", 1, MaxPeakBands, DefaultNumPeakBands));
+    for (int peak = DefaultNumPeakBands; peak < MaxPeakBands; ++peak) {
+        addPeakParameters(layout, peak);
+        addPeakBypassParameter(layout, peak);
+        addDynamicBandParameters(layout, peak);
+    }
     return layout;
 }
 
@@ -315,3 +1797,378 @@ juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
 {
     return new SimpleEQFromTutorialAudioProcessor();
 }
+
+#if SIMPLEEQ_HOST_SIMULATION
+HostSimulation::Result HostSimulation::run(const Settings& settings) {
+    SimpleEQFromTutorialAudioProcessor processor;
+    juce::Random random(settings.seed);
+
+    processor.setPlayConfigDetails(2, 2, settings.sampleRate, settings.maxBlockSize);
+    processor.prepareToPlay(settings.sampleRate, settings.maxBlockSize);
+    processor.analyzerConsumerActive.store(true);
+    processor.preEQTapEnabled.store(true);
+
+    auto lanes = settings.lanes;
+    if (lanes.empty()) {
+        auto numPoints = juce::jmax(1, (int)(settings.seconds * settings.automationPointsPerSecond));
+        for (auto* p : processor.getParameters()) {
+            if (auto* withID = dynamic_cast<juce::AudioProcessorParameterWithID*>(p)) {
+                AutomationLane lane{ withID->getParameterID(), {} };
+                for (int i = 0; i < numPoints; ++i)
+                    lane.points.emplace_back(settings.seconds * i / numPoints, random.nextFloat());
+                lanes.push_back(std::move(lane));
+            }
+        }
+    }
+
+    std::vector<std::pair<juce::RangedAudioParameter*, const AutomationLane*>> targets;
+    for (const auto& lane : lanes)
+        if (auto* parameter = processor.apvts.getParameter(lane.parameterID))
+            targets.emplace_back(parameter, &lane);
+    std::vector<size_t> nextPoint(targets.size(), 0);
+
+    juce::AudioBuffer<float> buffer(2, settings.maxBlockSize);
+    juce::AudioBuffer<float> fifoBuffer;
+    juce::MidiBuffer midi;
+    Result result;
+    double loadSum = 0.0;
+    const auto totalSamples = (juce::int64)(settings.seconds * settings.sampleRate);
+
+    for (juce::int64 position = 0; position < totalSamples;) {
+        auto numSamples = (result.numCallbacks % juce::jmax(1, settings.singleSampleEvery) == 0)
+                              ? 1 : 1 + random.nextInt(settings.maxBlockSize);
+        numSamples = (int)juce::jmin((juce::int64)numSamples, totalSamples - position);
+        auto time = position / settings.sampleRate;
+
+        //hosts apply automation at block boundaries
+        for (size_t t = 0; t < targets.size(); ++t) {
+            const auto& points = targets[t].second->points;
+            auto& next = nextPoint[t];
+            bool moved = false;
+            while (next < points.size() && points[next].first <= time) {
+                ++next;
+                moved = true;
+            }
+            if (moved)
+                targets[t].first->setValueNotifyingHost(points[next - 1].second);
+        }
+
+        buffer.setSize(2, numSamples, false, false, true);
+        for (int ch = 0; ch < 2; ++ch)
+            for (int i = 0; i < numSamples; ++i)
+                buffer.setSample(ch, i, random.nextFloat() * 2.0f - 1.0f);
+
+        auto start = juce::Time::getHighResolutionTicks();
+        processor.processBlock(buffer, midi);
+        auto elapsed = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+
+        auto load = elapsed / (numSamples / settings.sampleRate);
+        result.blockSizes.push_back(numSamples);
+        result.callbackLoads.push_back(load);
+        result.worstLoad = juce::jmax(result.worstLoad, load);
+        loadSum += load;
+        if (load > 1.0)
+            ++result.numMisses;
+        ++result.numCallbacks;
+
+        //the editor's side of the FIFOs
+        while (processor.leftChannelFifo.getAudioBuffer(fifoBuffer)) {}
+        while (processor.rightChannelFifo.getAudioBuffer(fifoBuffer)) {}
+
+        position += numSamples;
+    }
+
+    result.averageLoad = result.numCallbacks > 0 ? loadSum / result.numCallbacks : 0.0;
+    processor.releaseResources();
+    return result;
+}
+
+std::vector<HostSimulation::SlopeBenchmark> HostSimulation::benchmarkSlopes(double sampleRate, float cutoff) {
+    constexpr int blockSize = 512;
+    constexpr double pi = juce::MathConstants<double>::pi;
+    std::vector<SlopeBenchmark> results;
+    juce::Random random(1);
+    juce::AudioBuffer<float> buffer(2, blockSize);
+
+    for (int slope = Slope_12; slope <= Slope_96; ++slope) {
+        BandEngine engine;
+        auto band = engine.addBand(BandEngine::BandType::LowCut);
+        engine.prepare(sampleRate);
+        engine.setCut(band, cutoff, slope);
+
+        SlopeBenchmark benchmark;
+        benchmark.decibelsPerOctave = 12 * (slope + 1);
+
+        //cost, over a second of stereo noise
+        const auto numBlocks = juce::jmax(1, juce::roundToInt(sampleRate / blockSize));
+        double seconds = 0.0;
+        for (int b = 0; b < numBlocks; ++b) {
+            for (int ch = 0; ch < 2; ++ch)
+                for (int i = 0; i < blockSize; ++i)
+                    buffer.setSample(ch, i, random.nextFloat() * 2.0f - 1.0f);
+
+            auto start = juce::Time::getHighResolutionTicks();
+            engine.process(buffer.getArrayOfWritePointers(), 2, blockSize);
+            seconds += juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+        }
+        benchmark.nanosecondsPerSample = seconds * 1.0e9 / (numBlocks * blockSize * 2.0);
+
+        //accuracy. each probe settles for two seconds, far longer than the slowest pole rings, and its
+        //level is then read over whole periods
+        const auto order = 2 * (slope + 1);
+        const auto warpedCutoff = std::tan(pi * cutoff / sampleRate);
+        for (auto ratio : { 0.5, 0.75, 1.0, 1.5 }) {
+            const auto freq = cutoff * ratio;
+            const auto warpedRatio = warpedCutoff / std::tan(pi * freq / sampleRate);
+            const auto expected = -10.0 * std::log10(1.0 + std::pow(warpedRatio, 2.0 * order));
+
+            const auto settleSamples = (juce::int64)(2.0 * sampleRate);
+            const auto measureSamples = (juce::int64)std::round(std::floor(freq) * sampleRate / freq);
+            double sumOfSquares = 0.0;
+            engine.reset();
+
+            for (juce::int64 position = 0; position < settleSamples + measureSamples; position += blockSize) {
+                auto numSamples = (int)juce::jmin((juce::int64)blockSize, settleSamples + measureSamples - position);
+                for (int i = 0; i < numSamples; ++i) {
+                    auto x = (float)std::sin(2.0 * pi * freq * double(position + i) / sampleRate);
+                    buffer.setSample(0, i, x);
+                    buffer.setSample(1, i, x);
+                }
+                engine.process(buffer.getArrayOfWritePointers(), 2, numSamples);
+
+                for (int i = 0; i < numSamples; ++i)
+                    if (position + i >= settleSamples)
+                        sumOfSquares += double(buffer.getSample(0, i)) * buffer.getSample(0, i);
+            }
+
+            //a unit sine has an rms of 1/sqrt(2)
+            auto measured = 10.0 * std::log10(juce::jmax(1.0e-30, 2.0 * sumOfSquares / measureSamples));
+            auto error = std::isfinite(measured) ? std::abs(measured - expected) : std::numeric_limits<double>::infinity();
+            benchmark.worstErrorInDecibels = juce::jmax(benchmark.worstErrorInDecibels, error);
+        }
+
+        results.push_back(benchmark);
+    }
+    return results;
+}
+
+namespace {
+    //the chain the band engine replaced: JUCE's designs run one section at a time through IIR::Filter
+    struct ReferenceChain {
+        using Filter = juce::dsp::IIR::Filter<double>;
+        using Coefficients = juce::dsp::IIR::Coefficients<double>;
+
+        ReferenceChain(const ChainSettings& s, double sampleRate) {
+            auto addCut = [this, sampleRate](float freq, int slope, bool highPass) {
+                const auto order = 2 * (slope + 1);
+                auto sections = highPass
+                    ? juce::dsp::FilterDesign<double>::designIIRHighpassHighOrderButterworthMethod(freq, sampleRate, order)
+                    : juce::dsp::FilterDesign<double>::designIIRLowpassHighOrderButterworthMethod(freq, sampleRate, order);
+                for (auto* section : sections)
+                    addSection(*section);
+            };
+
+            if (!s.lowCutBypass)
+                addCut(s.lowCutFreq, s.lowCutSlope, true);
+            for (int i = 0; i < MaxPeakBands; ++i)
+                if (s.isPeakActive(i))
+                    addSection(*Coefficients::makePeakFilter(sampleRate, s.peaks[i].freq, s.peaks[i].quality,
+                                                             juce::Decibels::decibelsToGain((double)s.peaks[i].gainInDecibels)));
+            if (!s.highCutBypass)
+                addCut(s.highCutFreq, s.highCutSlope, false);
+        }
+
+        float processSample(float x) {
+            double y = x;
+            for (auto& filter : filters)
+                y = filter.processSample(y);
+            return (float)y;
+        }
+
+    private:
+        std::vector<Filter> filters;
+        void addSection(const Coefficients& c) {
+            filters.emplace_back();
+            filters.back().coefficients = new Coefficients(c);
+            filters.back().reset();
+        }
+    };
+
+    //|H|^2 of the textbook peak filter at 'freq', straight from its transfer function
+    double analyticPeakDecibels(double sampleRate, double centre, double quality, double gainInDecibels, double freq) {
+        const auto A = std::pow(10.0, gainInDecibels / 40.0);
+        const auto w0 = juce::MathConstants<double>::twoPi * centre / sampleRate;
+        const auto alpha = std::sin(w0) / (2.0 * quality);
+        const auto z1 = std::polar(1.0, -juce::MathConstants<double>::twoPi * freq / sampleRate);
+        const auto z2 = z1 * z1;
+        const auto h = (1.0 + alpha * A - 2.0 * std::cos(w0) * z1 + (1.0 - alpha * A) * z2)
+                     / (1.0 + alpha / A - 2.0 * std::cos(w0) * z1 + (1.0 - alpha / A) * z2);
+        return 20.0 * std::log10(std::abs(h));
+    }
+
+    //bilinear Butterworth of 'order', the cutoff prewarped so it lands where asked
+    double analyticButterworthDecibels(double sampleRate, double cutoff, int order, bool highPass, double freq) {
+        const auto pi = juce::MathConstants<double>::pi;
+        auto ratio = std::tan(pi * freq / sampleRate) / std::tan(pi * cutoff / sampleRate);
+        if (highPass)
+            ratio = 1.0 / ratio;
+        return -10.0 * std::log10(1.0 + std::pow(ratio, 2.0 * order));
+    }
+}
+
+HostSimulation::NullTestResult HostSimulation::runNullTests(const NullTestSettings& settings) {
+    NullTestResult result;
+    const auto pi = juce::MathConstants<double>::pi;
+    const int numSamples = settings.numSamples;
+    //jittered like a host, single samples included
+    constexpr int blockSizes[] = { 1, 17, 256, 512, 63, 2 };
+
+    //every band away from its default, so a band that isn't processed shows up
+    ChainSettings base;
+    base.lowCutFreq = 80.0f;
+    base.highCutFreq = 12000.0f;
+    base.peaks[0] = { 250.0f, 6.0f, 0.7f, false };
+    base.peaks[1] = { 1500.0f, -9.0f, 2.0f, false };
+    base.peaks[2] = { 6000.0f, 12.0f, 4.0f, false };
+    //and one past the count, which mustn't be heard
+    base.numPeaks = 3;
+    base.peaks[3] = { 3000.0f, 12.0f, 1.0f, false };
+
+    enum Signal { Sweep, Impulse, Noise, NumSignals };
+    const char* signalNames[] = { "sweep", "impulse", "noise" };
+
+    for (auto sampleRate : settings.sampleRates) {
+        //log sweep 20Hz to 0.45 fs, a unit impulse, and white noise at -6 dBFS
+        std::array<std::vector<float>, NumSignals> signals;
+        for (auto& signal : signals)
+            signal.assign(numSamples, 0.0f);
+        const auto sweepEnd = 0.45 * sampleRate, sweepRate = std::log(sweepEnd / 20.0) / numSamples;
+        juce::Random random(1);
+        for (int i = 0; i < numSamples; ++i) {
+            signals[Sweep][i] = (float)(0.5 * std::sin(2.0 * pi * 20.0 / sampleRate * (std::exp(sweepRate * i) - 1.0) / sweepRate));
+            signals[Noise][i] = random.nextFloat() - 0.5f;
+        }
+        signals[Impulse][0] = 1.0f;
+
+        juce::AudioBuffer<float> buffer(2, numSamples);
+        std::vector<float> expected[2];
+
+        for (int slope = Slope_12; slope <= Slope_96; ++slope) {
+            auto chain = base;
+            //both cuts, at opposite ends of the slope range
+            chain.lowCutSlope = slope;
+            chain.highCutSlope = Slope_96 - slope;
+
+            std::array<double, NumSignals> worst;
+            worst.fill(-300.0);
+
+            //bit 0 the low cut, bit 1 the high cut, then one per counted peak
+            for (juce::uint32 bypassed = 0; bypassed < (1u << (2 + chain.numPeaks)); ++bypassed) {
+                chain.lowCutBypass = (bypassed & 1u) != 0;
+                chain.highCutBypass = (bypassed & 2u) != 0;
+                for (int i = 0; i < chain.numPeaks; ++i)
+                    chain.peaks[i].bypass = (bypassed & (4u << i)) != 0;
+
+                for (int signal = 0; signal < NumSignals; ++signal) {
+                    BandEngine engine;
+                    addEqualizerBands(engine);
+                    engine.prepare(sampleRate);
+                    for (int band = 0; band < NumBands; ++band)
+                        applyBandSettings(engine, chain, band);
+
+                    //the right channel gets the signal inverted and halved, so the channels can't share state unnoticed
+                    for (int ch = 0; ch < 2; ++ch) {
+                        ReferenceChain reference(chain, sampleRate);
+                        expected[ch].resize(numSamples);
+                        const auto scale = ch == 0 ? 1.0f : -0.5f;
+                        for (int i = 0; i < numSamples; ++i) {
+                            buffer.setSample(ch, i, signals[signal][i] * scale);
+                            expected[ch][i] = reference.processSample(signals[signal][i] * scale);
+                        }
+                    }
+
+                    for (int position = 0, b = 0; position < numSamples; ++b) {
+                        auto num = juce::jmin(blockSizes[b % juce::numElementsInArray(blockSizes)], numSamples - position);
+                        float* channels[] = { buffer.getWritePointer(0, position), buffer.getWritePointer(1, position) };
+                        engine.process(channels, 2, num);
+                        position += num;
+                    }
+
+                    double largest = 0.0;
+                    for (int ch = 0; ch < 2; ++ch)
+                        for (int i = 0; i < numSamples; ++i)
+                            largest = juce::jmax(largest, (double)std::abs(buffer.getSample(ch, i) - expected[ch][i]));
+                    worst[signal] = juce::jmax(worst[signal], 20.0 * std::log10(juce::jmax(largest, 1.0e-15)));
+                }
+            }
+
+            for (int signal = 0; signal < NumSignals; ++signal) {
+                NullTestCase test;
+                test.name << juce::String(sampleRate, 0) << " Hz, " << 12 * (slope + 1) << "/" << 12 * (Slope_96 - slope + 1)
+                          << " dB/oct, " << signalNames[signal] << ", " << chain.numPeaks << " peaks, all bypass combinations";
+                test.worst = worst[signal];
+                test.passed = test.worst <= settings.maxRenderDeviationInDecibels;
+                result.passed &= test.passed;
+                result.renders.push_back(test);
+            }
+        }
+
+        //designed responses, one band at a time on the evaluator the editor draws with
+        BiquadMagnitudeEvaluator grid;
+        grid.prepare(512, sampleRate, 20.0, juce::jmin(20000.0, 0.49 * sampleRate));
+        std::vector<float> designed(grid.getNumPoints());
+        std::array<BiquadCoefficients, BandEngine::MaxCutSections> sections;
+
+        auto checkResponse = [&](const juce::String& name, BandEngine& engine, int band, const std::function<double(double)>& analytic) {
+            grid.evaluate(sections.data(), engine.getActiveSections(band, sections.data()), designed.data());
+            NullTestCase test;
+            test.name = name;
+            test.worst = 0.0;
+            for (int p = 0; p < grid.getNumPoints(); ++p) {
+                auto expectedDecibels = analytic(grid.getFrequency(p));
+                if (expectedDecibels > -100.0)
+                    test.worst = juce::jmax(test.worst, std::abs(designed[p] - expectedDecibels));
+            }
+            test.passed = test.worst <= settings.maxResponseErrorInDecibels;
+            result.passed &= test.passed;
+            result.responses.push_back(test);
+        };
+
+        for (int slope = Slope_12; slope <= Slope_96; ++slope) {
+            BandEngine engine;
+            auto lowCut = engine.addBand(BandEngine::BandType::LowCut);
+            auto highCut = engine.addBand(BandEngine::BandType::HighCut);
+            engine.prepare(sampleRate);
+            engine.setCut(lowCut, base.lowCutFreq, slope);
+            engine.setCut(highCut, base.highCutFreq, slope);
+
+            const auto order = 2 * (slope + 1);
+            const auto name = juce::String(sampleRate, 0) + " Hz, " + juce::String(12 * (slope + 1)) + " dB/oct ";
+            checkResponse(name + "low cut", engine, lowCut, [&](double f) {
+                return analyticButterworthDecibels(sampleRate, base.lowCutFreq, order, true, f);
+            });
+            checkResponse(name + "high cut", engine, highCut, [&](double f) {
+                return analyticButterworthDecibels(sampleRate, base.highCutFreq, order, false, f);
+            });
+        }
+
+        for (auto gain : { -24.0f, -6.0f, 0.0f, 6.0f, 24.0f }) {
+            for (auto quality : { 0.1f, 1.0f, 10.0f }) {
+                for (auto freq : { 40.0f, 1000.0f, 16000.0f }) {
+                    BandEngine engine;
+                    auto peak = engine.addBand(BandEngine::BandType::Peak);
+                    engine.prepare(sampleRate);
+                    engine.setPeak(peak, freq, quality, gain);
+
+                    juce::String name;
+                    name << juce::String(sampleRate, 0) << " Hz, peak " << freq << " Hz " << gain << " dB Q " << quality;
+                    checkResponse(name, engine, peak, [&](double f) {
+                        return analyticPeakDecibels(sampleRate, freq, quality, gain, f);
+                    });
+                }
+            }
+        }
+    }
+    return result;
+}
+#endif
@@ -10,8 +10,81 @@
 
 #include <JuceHeader.h>
 #include <array>
+#include <thread>
+
+//the console test runner isn't a plugin project, so it doesn't get these from JucePluginDefines.h
+#if ! defined (JucePlugin_Name)
+ #define JucePlugin_Name "SimpleEQFromTutorial"
+ #define JucePlugin_IsSynth 0
+ #define JucePlugin_WantsMidiInput 0
+ #define JucePlugin_ProducesMidiOutput 0
+ #define JucePlugin_IsMidiEffect 0
+#endif
+
+#ifndef SIMPLEEQ_TRACING
+ #define SIMPLEEQ_TRACING 0
+#endif
+
+#if SIMPLEEQ_TRACING && ! JUCE_DEBUG
+ #error "SIMPLEEQ_TRACING is a debugging aid, it's only supported in debug builds"
+#endif
+
+#if SIMPLEEQ_TRACING
+/**
+ process wide recorder of scoped trace markers, for seeing the audio, worker and message threads on one timeline.
+ every thread claims one of a fixed set of rings the first time it records, so recording never allocates or locks:
+ it's a clock read at each end of the scope and a few relaxed stores. the rings overwrite their oldest events.
+ a thread gives its ring back when it ends, so the next one carries on in the same lane. while all of them are
+ taken events are dropped and counted. writeChromeTrace() dumps what the rings hold as Chrome trace JSON, which
+ Perfetto opens too. debug builds only, with SIMPLEEQ_TRACING=1. without it SIMPLEEQ_TRACE_SCOPE expands to nothing
+ */
+struct TraceRecorder
+{
+    //allocates the rings. called from the processor's constructor, so no audio thread event ever has to
+    static void prepare();
+    //'name' has to outlive the recorder, a string literal. 'value' is shown as the event's argument when >= 0
+    static void record(const char* name, juce::int64 startTicks, juce::int64 endTicks, int value);
+    static juce::String createChromeTrace();
+    static bool writeChromeTrace(const juce::File& file);
+private:
+    static constexpr int MaxThreads = 32;
+    static constexpr juce::uint32 RingSize = 1u << 14;
+
+    struct Event
+    {
+        std::atomic<const char*> name{ nullptr };
+        std::atomic<juce::int64> start{ 0 }, end{ 0 };
+        std::atomic<int> value{ -1 };
+    };
+    struct Ring
+    {
+        std::array<Event, RingSize> events;
+        //single writer, the owning thread. the reader keeps only what wasn't overwritten while it was copying
+        std::atomic<juce::uint32> numWritten{ 0 }, numStarted{ 0 };
+        std::atomic<bool> inUse{ false }, isMessageThread{ false };
+    };
+    static std::array<Ring, MaxThreads>& getRings();
+    //events recorded while every ring belonged to another thread
+    static std::atomic<juce::uint32>& getNumDropped();
+    static Ring* getRingForThisThread();
+};
 
-template<typename T>
+struct ScopedTrace
+{
+    ScopedTrace(const char* eventName, int eventValue = -1)
+        : name(eventName), value(eventValue), start(juce::Time::getHighResolutionTicks()) {}
+    ~ScopedTrace() { TraceRecorder::record(name, start, juce::Time::getHighResolutionTicks(), value); }
+    const char* name;
+    int value;
+    juce::int64 start;
+};
+
+ #define SIMPLEEQ_TRACE_SCOPE(...) ScopedTrace JUCE_JOIN_MACRO(simpleEqTrace, __LINE__)(__VA_ARGS__)
+#else
+ #define SIMPLEEQ_TRACE_SCOPE(...)
+#endif
+
+template<typename T, int Capacity = 30>
 struct Fifo
 {
     void prepare(int numChannels, int numSamples)
@@ -68,8 +141,20 @@ struct Fifo
     {
         return fifo.getNumReady();
     }
+
+    //neither side may be using it
+    void reset()
+    {
+        fifo.reset();
+    }
+
+    //reader side only, throws away everything that is currently queued
+    void discardAll()
+    {
+        auto read = fifo.read(fifo.getNumReady());
+        juce::ignoreUnused(read);
+    }
 private:
-    static constexpr int Capacity = 30;
     std::array<T, Capacity> buffers;
     juce::AbstractFifo fifo{ Capacity };
 };
@@ -80,66 +165,141 @@ enum Channel
     Right //effectively 1
 };
 
+//channels of the buffers handed out by SingleChannelSampleFifo
+enum AnalyzerTap
+{
+    PostEQ, //what the plugin outputs
+    PreEQ,  //what came in, only filled while the pre-EQ tap is on
+    NumAnalyzerTaps
+};
+
+/**
+ the audio thread's analyzer feed for one channel. prepare() never touches a queue the consumer may be reading:
+ there are two configurations, and a new one is built in the one that isn't live and then published by bumping
+ the generation, whose low bit names the live one. the consumer registers on a configuration before reading it
+ and checks the generation again afterwards, and prepare() waits for a registered reader to leave before
+ building over it. a consumer that sees the generation move drops what it held, reconfigured() tells it once
+ */
 template<typename BlockType>
 struct SingleChannelSampleFifo
 {
-    SingleChannelSampleFifo(Channel ch) : channelToUse(ch)
-    {
-        prepared.set(false);
-    }
+    SingleChannelSampleFifo(Channel ch) : channelToUse(ch) {}
 
-    void update(const BlockType& buffer)
+    //pass the unprocessed input as 'preEQBuffer' to fill the PreEQ channel, otherwise it stays silent
+    void update(const BlockType& buffer, const BlockType* preEQBuffer = nullptr)
     {
-        jassert(prepared.get());
+        SIMPLEEQ_TRACE_SCOPE("SingleChannelSampleFifo::update", channelToUse);
+        jassert(isPrepared());
         jassert(buffer.getNumChannels() > channelToUse);
         auto* channelPtr = buffer.getReadPointer(channelToUse);
+        auto* preEQPtr = preEQBuffer != nullptr ? preEQBuffer->getReadPointer(channelToUse) : nullptr;
 
         for (int i = 0; i < buffer.getNumSamples(); ++i)
         {
-            pushNextSampleIntoFifo(channelPtr[i]);
+            pushNextSampleIntoFifo(channelPtr[i], preEQPtr != nullptr ? preEQPtr[i] : 0.0f);
         }
     }
 
+    //audio side, never concurrent with update()
     void prepare(int bufferSize)
     {
-        prepared.set(false);
-        size.set(bufferSize);
+        const auto generation = liveGeneration.load();
+        auto& next = configurations[(generation + 1) & 1];
 
-        bufferToFill.setSize(1,             //channel
+        //only a pull that started before the previous prepare() can still be on it, and it's a copy away from leaving
+        while (next.readers.load() != 0)
+            std::this_thread::yield();
+
+        next.audioBufferFifo.reset();
+        next.audioBufferFifo.prepare(NumAnalyzerTaps, bufferSize);
+        bufferToFill.setSize(NumAnalyzerTaps, //channels
             bufferSize,    //num samples
             false,         //keepExistingContent
             true,          //clear extra space
             true);         //avoid reallocating
-        audioBufferFifo.prepare(1, bufferSize);
         fifoIndex = 0;
-        prepared.set(true);
+        size.set(bufferSize);
+
+        liveGeneration.store(generation + 1);
     }
     //==============================================================================
-    int getNumCompleteBuffersAvailable() const { return audioBufferFifo.getNumAvailableForReading(); }
-    bool isPrepared() const { return prepared.get(); }
+    int getNumCompleteBuffersAvailable()
+    {
+        int numAvailable = 0;
+        read([&numAvailable](auto& fifo) { numAvailable = fifo.getNumAvailableForReading(); });
+        return numAvailable;
+    }
+    bool isPrepared() const { return liveGeneration.load() != 0; }
     int getSize() const { return size.get(); }
     //==============================================================================
-    bool getAudioBuffer(BlockType& buf) { return audioBufferFifo.pull(buf); }
+    //consumer side. false when nothing is queued, or when the configuration changed since the last call
+    bool getAudioBuffer(BlockType& buf)
+    {
+        bool pulled = false;
+        read([&](auto& fifo) { pulled = fifo.pull(buf); });
+        return pulled;
+    }
+    //consumer side: true once for every time the consumer noticed a new configuration. buffers from the old
+    //one are gone, so anything built from them is stale
+    bool reconfigured() { return std::exchange(reconfigurationSeen, false); }
+    //audio thread: drop the half filled buffer when feeding resumes after a pause
+    void restart() { fifoIndex = 0; }
+    //gui thread: drop buffers queued before the consumer started listening
+    void discardPendingBuffers() { read([](auto& fifo) { fifo.discardAll(); }); }
 private:
     Channel channelToUse;
     int fifoIndex = 0;
-    Fifo<BlockType> audioBufferFifo;
     BlockType bufferToFill;
-    juce::Atomic<bool> prepared = false;
     juce::Atomic<int> size = 0;
 
-    void pushNextSampleIntoFifo(float sample)
+    struct Configuration
+    {
+        Fifo<BlockType> audioBufferFifo;
+        std::atomic<int> readers{ 0 };
+    };
+    std::array<Configuration, 2> configurations;
+    //0 until the first prepare(). the default sequentially consistent ordering is what makes the reader count
+    //and generation checks see each other
+    std::atomic<juce::uint32> liveGeneration{ 0 };
+    //consumer side
+    juce::uint32 consumerGeneration = 0;
+    bool reconfigurationSeen = false;
+
+    Fifo<BlockType>& getLiveFifo() { return configurations[liveGeneration.load() & 1].audioBufferFifo; }
+
+    template<typename Function>
+    void read(Function&& function)
+    {
+        const auto generation = liveGeneration.load();
+        if (generation != consumerGeneration)
+        {
+            consumerGeneration = generation;
+            reconfigurationSeen = true;
+        }
+        if (generation == 0)
+            return;
+
+        auto& configuration = configurations[generation & 1];
+        configuration.readers.fetch_add(1);
+        //moved on before we registered, so prepare() may be building this one. the next call reads the new one
+        if (liveGeneration.load() == generation)
+            function(configuration.audioBufferFifo);
+        configuration.readers.fetch_sub(1);
+    }
+
+    void pushNextSampleIntoFifo(float sample, float preEQSample)
     {
         if (fifoIndex == bufferToFill.getNumSamples())
         {
-            auto ok = audioBufferFifo.push(bufferToFill);
+            auto ok = getLiveFifo().push(bufferToFill);
 
             juce::ignoreUnused(ok);
 
             fifoIndex = 0;
         }
 
-        bufferToFill.setSample(0, fifoIndex, sample);
+        bufferToFill.setSample(AnalyzerTap::PostEQ, fifoIndex, sample);
+        bufferToFill.setSample(AnalyzerTap::PreEQ, fifoIndex, preEQSample);
         ++fifoIndex;
     }
 };
@@ -149,85 +309,265 @@ enum Slope {
     Slope_12,
     Slope_24,
     Slope_36,
-    Slope_48
+    Slope_48,
+    Slope_60,
+    Slope_72,
+    Slope_84,
+    Slope_96
+};
+
+//peak bands that have parameters, with the two cuts they fill the BandEngine. "Peak Count" of them are in use
+constexpr int MaxPeakBands = 22;
+//the count's default, and what sessions saved before there was a count always had
+constexpr int DefaultNumPeakBands = 3;
+
+//band order in the engine and in ChainSettings: low cut, the peaks, high cut
+enum BandIndex {
+    LowCutBand = 0,
+    FirstPeakBand = 1,
+    HighCutBand = FirstPeakBand + MaxPeakBands,
+    NumBands
+};
+
+struct PeakBandSettings {
+    float freq{ 0 }, gainInDecibels{ 0 }, quality{ 1.0f };
+    bool bypass{ false };
 };
 
 struct ChainSettings {
-    float peak1Freq{ 0 }, peak1GainInDecibels{ 0 }, peak1Quality{ 1.0f };
-    float peak2Freq{ 0 }, peak2GainInDecibels{ 0 }, peak2Quality{ 1.0f };
-    float peak3Freq{ 0 }, peak3GainInDecibels{ 0 }, peak3Quality{ 1.0f };
+    std::array<PeakBandSettings, MaxPeakBands> peaks;
+    //peaks from numPeaks on are off whatever their own bypass says, and keep their settings for when they're back
+    int numPeaks{ DefaultNumPeakBands };
     float lowCutFreq{ 0 }, highCutFreq{ 0 };
     int lowCutSlope{ Slope::Slope_12 }, highCutSlope{ Slope::Slope_12 };
-    bool lowCutBypass{ false }, highCutBypass{ false }, peak1Bypass{ false }, peak2Bypass{ false }, peak3Bypass{ false };
+    bool lowCutBypass{ false }, highCutBypass{ false };
+
+    bool isPeakActive(int peak) const { return peak < numPeaks && !peaks[peak].bypass; }
+};
+
+//"Peak 2 " etc, the prefix of every parameter of that peak band
+juce::String getPeakParameterPrefix(int peak);
+
+/** the raw parameter values behind ChainSettings, looked up by id once so loading them is just atomic reads */
+struct ChainParameterValues
+{
+    explicit ChainParameterValues(juce::AudioProcessorValueTreeState& apvts);
+    ChainSettings load() const;
+private:
+    std::atomic<float>* lowCutFreq = nullptr, * highCutFreq = nullptr, * lowCutSlope = nullptr, * highCutSlope = nullptr,
+                      * lowCutBypass = nullptr, * highCutBypass = nullptr, * numPeaks = nullptr;
+    struct Peak {
+        std::atomic<float>* freq = nullptr, * gain = nullptr, * quality = nullptr, * bypass = nullptr;
+    };
+    std::array<Peak, MaxPeakBands> peaks;
 };
 
 ChainSettings getChainSettings(juce::AudioProcessorValueTreeState& apvts);
+//position 0 is a, 1 is b. frequency and Q move in log, gain in dB, slopes and cut bypasses switch halfway.
+//a bypassed peak, or one past a's or b's count, counts as a flat one, so it fades in and out instead of switching
+ChainSettings morphChainSettings(const ChainSettings& a, const ChainSettings& b, float position);
+
+//one second order section, a0 normalised to 1. double, a low cut at 20 Hz and 192 kHz has an a1 closer to -2
+//than a float can tell apart
+struct BiquadCoefficients {
+    double b0 = 1.0, b1 = 0.0, b2 = 0.0, a1 = 0.0, a2 = 0.0;
+};
 
-using Filter = juce::dsp::IIR::Filter<float>;
-using CutFilter = juce::dsp::ProcessorChain<Filter, Filter, Filter, Filter>;
-using MonoChain = juce::dsp::ProcessorChain<CutFilter, Filter, Filter, Filter, CutFilter>;
+//allocation free designers, safe on the audio thread. they match IIR::Coefficients::makePeakFilter and the Butterworth methods
+//of FilterDesign. 'section' indexes the biquads of an even 'order' cascade, up to BandEngine::MaxCutSections of them.
+//their Qs come from a compile time table, so a section costs a tan and a few divides
+BiquadCoefficients makePeakBiquad(double sampleRate, float freq, float quality, float gainInDecibels);
+BiquadCoefficients makeButterworthSection(double sampleRate, float freq, int order, int section, bool highPass);
 
-enum ChainPositions {
-    LowCut,
-    Peak1,
-    Peak2,
-    Peak3,
-    HighCut
+/**
+ the gain independent half of makePeakBiquad. prepare it once per block for a band's frequency and Q, then
+ apply() costs a pow and a handful of multiplies, cheap enough to follow a dynamic gain every few samples
+ */
+struct PeakGainDesigner
+{
+    void prepare(double sampleRate, float freq, float quality);
+    BiquadCoefficients apply(float gainInDecibels) const;
+private:
+    double alpha = 0.0, c2 = 0.0;
 };
 
-using Coefficients = Filter::CoefficientsPtr;
-void updateCoefficients(Coefficients& old, const Coefficients& replacements);
+/**
+ detector and gain computer of a dynamic peak band. the detector band passes its input at the band's frequency
+ and Q and follows the peak level with separate attack and release, the gain computer turns level above the
+ threshold into a cut of the band's gain. everything per sample stays in the linear domain, the level is only
+ converted to dB once per call
+ */
+struct DynamicBand
+{
+    void prepare(double sampleRate);
+    void reset();
+    //once per block, recomputes only what changed
+    void setParameters(float freq, float quality, float thresholdInDecibels, float ratio, float attackMs, float releaseMs);
+    //runs the detector over 'numSamples' of the detector signal and returns the gain reduction in dB, >= 0
+    float process(const float* detectorSignal, int numSamples);
+
+    static constexpr float MaxReductionInDecibels = 24.0f;
+private:
+    double sampleRate = 44100.0;
+    float freq = 0.0f, quality = 0.0f, attackMs = -1.0f, releaseMs = -1.0f;
+    float threshold = 0.0f, slope = 0.0f;
+    //band pass, transposed direct form II
+    float b0 = 0.0f, b2 = 0.0f, a1 = 0.0f, a2 = 0.0f, z1 = 0.0f, z2 = 0.0f;
+    float attackCoeff = 0.0f, releaseCoeff = 0.0f, envelope = 0.0f;
+};
 
-Coefficients makePeak1Filter(const ChainSettings& chainSettings, double sampleRate);
-Coefficients makePeak2Filter(const ChainSettings& chainSettings, double sampleRate);
-Coefficients makePeak3Filter(const ChainSettings& chainSettings, double sampleRate);
+/**
+ the filter bank behind the EQ. bands are a runtime list, each owning a contiguous run of biquad sections, and
+ every section keeps its coefficients and per channel state in structure of arrays storage. processing walks the
+ active sections of the unbypassed bands in order, so the cost is linear in what's switched on, and nothing is
+ reference counted or allocated after the bands are added. samples stay float, the sections run in double so
+ steep low cuts keep their poles where they were designed
+ */
+class BandEngine
+{
+public:
+    static constexpr int MaxBands = 24;
+    //96 dB/oct
+    static constexpr int MaxCutSections = 8;
+    static constexpr int MaxSections = MaxBands * MaxCutSections;
+    static constexpr int MaxChannels = 2;
+
+    enum class BandType { Peak, LowCut, HighCut };
+
+    //setup only. returns the new band's index, or -1 once MaxBands or MaxSections are used up
+    int addBand(BandType type);
+    int getNumBands() const { return numBands; }
+    BandType getBandType(int band) const { return bands[band].type; }
+
+    void prepare(double newSampleRate);
+    void reset();
+    double getSampleRate() const { return sampleRate; }
+
+    //everything below is allocation free
+    void setPeak(int band, float freq, float quality, float gainInDecibels);
+    //slope is a Slope, one section per 12 dB/oct. sections go in rising Q, so the resonant ones come last and
+    //only see what the gentler ones already let through
+    void setCut(int band, float freq, int slope);
+    void setSection(int band, int section, const BiquadCoefficients& coefficients);
+    void setBypassed(int band, bool shouldBeBypassed) { bands[band].bypassed = shouldBeBypassed; }
+    bool isBypassed(int band) const { return bands[band].bypassed; }
+    //copies the band's active sections into 'dest', which needs room for MaxCutSections. 0 when bypassed
+    int getActiveSections(int band, BiquadCoefficients* dest) const;
+
+    void process(float* const* channels, int numChannels, int numSamples);
+private:
+    struct Band {
+        BandType type = BandType::Peak;
+        int firstSection = 0, numSections = 0, numActiveSections = 0;
+        bool bypassed = false;
+    };
+    std::array<Band, MaxBands> bands{};
+    int numBands = 0, numSectionsUsed = 0;
+    double sampleRate = 44100.0;
 
-inline auto makeLowCutFilter(const ChainSettings& chainSettings, double sampleRate) {
-    return juce::dsp::FilterDesign<float>::designIIRHighpassHighOrderButterworthMethod(chainSettings.lowCutFreq, sampleRate,
-                                                                                      (chainSettings.lowCutSlope + 1) * 2);
-}
+    alignas(16) std::array<double, MaxSections> b0{}, b1{}, b2{}, a1{}, a2{};
+    //transposed direct form II state, per channel
+    alignas(16) std::array<std::array<double, MaxSections>, MaxChannels> z1{}, z2{};
+};
+static_assert(NumBands <= BandEngine::MaxBands, "every peak that has parameters needs a band in the engine");
 
-inline auto makeHighCutFilter(const ChainSettings& chainSettings, double sampleRate) {
-    return juce::dsp::FilterDesign<float>::designIIRLowpassHighOrderButterworthMethod(chainSettings.highCutFreq, sampleRate,
-                                                                                     (chainSettings.highCutSlope + 1) * 2);
-}
+//adds LowCutBand, the peaks and HighCutBand in BandIndex order
+void addEqualizerBands(BandEngine& engine);
+//designs one BandIndex band of 'engine' from the settings, including its bypass
+void applyBandSettings(BandEngine& engine, const ChainSettings& chainSettings, int band);
 
-//updated for the same reasons as updatCutFilter. The typename Coefficient was rejected by compiler. Maybe from Juce update?
-template<int Index, typename ChainType>
-void update(ChainType& chain, const juce::ReferenceCountedArray<juce::dsp::IIR::Coefficients<float>>& coefficients) {
-    updateCoefficients(chain.template get<Index>().coefficients, coefficients[Index]);
-    chain.template setBypassed<Index>(false);
-}
+/**
+ evaluates the combined magnitude response of a biquad cascade over a fixed log spaced frequency grid.
+ |H|^2 is written in terms of phi = sin^2(w/2), so each grid point caches one term and the low end stays
+ accurate even at high sample rates. numerator and denominator are multiplied up in SIMD lanes of doubles,
+ which long cascades can't underflow, and only divided and converted to dB once per point at the end.
+ */
+struct BiquadMagnitudeEvaluator
+{
+    void prepare(int numPoints, double sampleRate, double minFreq = 20.0, double maxFreq = 20000.0);
+    //writes getNumPoints() values
+    void evaluate(const BiquadCoefficients* sections, int numSections, float* magnitudesInDecibels);
 
-// slope is 0..3 (for 12/24/36/48 dB/oct), Juce was displeased with the Slope obj and treated it like an int. So now its an int
-//coeffs could probably be a less ridiculous type, but this is the only one I could get working 
-//uses fallthrough on the switch to update each lower order
-template <typename ChainType>
-void updateCutFilter(ChainType& filterChain, const juce::ReferenceCountedArray<juce::dsp::IIR::Coefficients<float>>& coeffs, int slope) {
-    filterChain.template setBypassed<0>(true);
-    filterChain.template setBypassed<1>(true);
-    filterChain.template setBypassed<2>(true);
-    filterChain.template setBypassed<3>(true);
-
-    switch (slope) {
-    case 3: {
-        update<3>(filterChain, coeffs);
-        [[fallthrough]];
-    }
-    case 2: {
-        update<2>(filterChain, coeffs);
-        [[fallthrough]];
-    }
-    case 1: {
-        update<1>(filterChain, coeffs);
-        [[fallthrough]];
-    }
-    case 0: {
-        update<0>(filterChain, coeffs);
-        [[fallthrough]];
-    }
-    }
-}
+    int getNumPoints() const { return (int)frequencies.size(); }
+    double getFrequency(int point) const { return frequencies[point]; }
+    double getSampleRate() const { return sampleRate; }
+private:
+    using Register = juce::dsp::SIMDRegister<double>;
+    static constexpr int NumLanes = (int)Register::SIMDNumElements;
+
+    std::vector<double> frequencies;
+    std::vector<Register> phi, numerator, denominator;
+    double sampleRate = 0.0;
+};
+
+/**
+ output gain that undoes the loudness change of the designed curve, worked out from the coefficients instead of
+ metered from the audio. the response is A-weighted and power averaged over the editor's 20Hz-20kHz log grid,
+ where every point covers the same fraction of an octave. a band is only evaluated again when its sections change
+ */
+struct AutoGainCompensation
+{
+    void prepare(double sampleRate);
+    //call once the engine is designed. returns true when the gain moved
+    bool update(const BandEngine& engine);
+    float getGainInDecibels() const { return gainInDecibels; }
+private:
+    static constexpr int NumPoints = 128;
+    static constexpr float MaxGainInDecibels = 24.0f;
+    BiquadMagnitudeEvaluator grid;
+    std::array<float, NumPoints> weights{};
+    //what each band was last evaluated with, -1 sections forces the first evaluation
+    std::array<std::array<BiquadCoefficients, BandEngine::MaxCutSections>, NumBands> bandSections;
+    std::array<int, NumBands> bandNumSections;
+    std::array<std::array<float, NumPoints>, NumBands> bandMagnitudes{};
+    float gainInDecibels = 0.0f;
+};
+
+/** the result of a WelchAnalyser, plain data so it can be copied between threads */
+struct AverageSpectrum
+{
+    double sampleRate = 0.0;
+    int fftSize = 0;
+    juce::int64 numFrames = 0;
+    //one per bin from dc to nyquist
+    std::vector<double> powerSums;
+
+    bool isEmpty() const { return numFrames == 0; }
+    //adds a capture with the same fft size, e.g. the other channel
+    void merge(const AverageSpectrum& other);
+    //mean power in dB over an 'octaveFraction' wide band around 'freq'
+    double getSmoothedDecibels(double freq, double octaveFraction) const;
+};
+
+/**
+ long term average spectrum by streaming Welch averaging: hann windowed frames at 50% overlap, their power
+ summed per bin. memory is one frame and one row of sums however long it runs
+ */
+struct WelchAnalyser
+{
+    void prepare(double sampleRate, int fftOrder = 13);
+    void reset();
+    void push(const float* samples, int numSamples);
+    const AverageSpectrum& getSpectrum() const { return spectrum; }
+private:
+    AverageSpectrum spectrum;
+    std::unique_ptr<juce::dsp::FFT> fft;
+    std::vector<float> window, ring, fftData;
+    int writePos = 0, samplesUntilFrame = 0;
+};
+
+//reads all of 'file', mixed to mono, into 'analyser'. 'shouldStop' is polled between blocks. false when the
+//file can't be read or reading was stopped
+bool analyseAudioFile(const juce::File& file, WelchAnalyser& analyser, const std::function<bool()>& shouldStop);
+
+//least squares fit of the cut frequencies and peaks of 'start' to 'targetDecibels', which is given on the grid
+//'grid' was prepared with. peaks are placed greedily where the error is largest and then refined together with
+//the cuts by Levenberg-Marquardt. slopes and cut bypasses are kept, peaks come back switched on
+ChainSettings fitChainSettings(BiquadMagnitudeEvaluator& grid, const ChainSettings& start, const float* targetDecibels, const float* weights);
+//match EQ: fits the EQ to the smoothed difference between the reference and the input spectrum. only the shape
+//is matched, the overall level difference is taken out first. false when there's too little to go on
+bool fitMatchEQ(const AverageSpectrum& input, const AverageSpectrum& reference, double sampleRate,
+                const ChainSettings& start, ChainSettings& result);
 
 //template to have true logarithmic skew for frequency sliders, dont forget to cast to float :)
 template <typename ValueT>
@@ -243,6 +583,112 @@ juce::NormalisableRange<ValueT> logRange(ValueT min, ValueT max)
 //==============================================================================
 /**
 */
+#ifndef SIMPLEEQ_TELEMETRY
+ #define SIMPLEEQ_TELEMETRY 0
+#endif
+
+#if SIMPLEEQ_TELEMETRY
+/**
+ one instance's slot in the telemetry segment. the layout is fixed and native endian, so a monitor in any language
+ can read it: 128 bytes per slot, after a first 128 bytes that start with the TelemetrySegment::Header. 'state' is 1
+ while the instance 'instanceId' owns the slot. the audio thread fills everything from blockCount on as a seqlock: 'sequence' is odd while it writes, so a
+ reader copies the slot and keeps the copy only if 'sequence' was even and unchanged on both sides of it
+ */
+struct alignas(128) TelemetryRecord
+{
+    static constexpr int NumEnergyBands = 4;
+
+    std::atomic<juce::uint32> state;
+    std::atomic<juce::uint32> sequence;
+    std::atomic<juce::uint32> instanceId;
+    juce::uint32 reserved;
+    //wall clock ms, bumped once a second from the message thread. it's also what owns the slot: a slot is taken by
+    //moving a heartbeat that's 0 or has stopped for StaleAfterMs, so an instance that crashed frees its slot
+    std::atomic<juce::int64> heartbeatMs;
+
+    juce::uint64 blockCount;
+    float sampleRate;
+    juce::int32 blockSize;
+    //processBlock's own time, and that over the duration of the block
+    float dspMicroseconds;
+    float dspLoad;
+    //bit n set when BandIndex n is bypassed, peaks past the peak count included
+    juce::uint32 bypassMask;
+    float outputPeak[2];
+    float outputRms[2];
+    //mean square of the output in dB below 250Hz, 250Hz-2kHz, 2-8kHz and above 8kHz
+    float bandEnergyDecibels[NumEnergyBands];
+};
+static_assert(sizeof(TelemetryRecord) == 128, "the record layout is what monitors read");
+static_assert(std::atomic<juce::uint32>::is_always_lock_free && std::atomic<juce::int64>::is_always_lock_free,
+              "the segment is shared between processes, its atomics can't hide a lock");
+
+/**
+ the named shared memory every instance of one user publishes into: the POSIX object "/SimpleEQ-Telemetry-<uid>",
+ created 0600 and only used when that user owns it, or the pagefile backed mapping "Local\\SimpleEQ Telemetry" in the
+ session's namespace on Windows. it's plain memory, not a file, so the audio thread never waits on a write back, and
+ the pages are locked where the system allows it. shared by the instances of a process through a
+ juce::SharedResourcePointer. when it can't be mapped there are no slots to claim and telemetry just stays off.
+ instances only hold slots while a monitor keeps Header::monitorHeartbeatMs within StaleAfterMs of the wall clock,
+ until then an instance's cost is a clock read and an atomic load once a second. only built with SIMPLEEQ_TELEMETRY=1
+ */
+struct TelemetrySegment
+{
+    struct Header
+    {
+        juce::uint32 magic, version, numSlots, recordSize;
+        //wall clock ms, written by monitors. while it's stale no instance claims a slot or publishes
+        std::atomic<juce::int64> monitorHeartbeatMs;
+    };
+    static constexpr juce::uint32 Magic = 0x54514553; //'SEQT'
+    //3: the header carries the monitors' heartbeat
+    static constexpr juce::uint32 Version = 3;
+    static constexpr juce::uint32 NumSlots = 512;
+    static constexpr juce::int64 StaleAfterMs = 10000;
+    static constexpr size_t TotalSize = sizeof(TelemetryRecord) * (NumSlots + 1);
+
+    TelemetrySegment();
+    ~TelemetrySegment();
+    //message thread. nullptr when every slot is taken
+    TelemetryRecord* claim(juce::uint32 instanceId);
+    //message thread, the heartbeat. false when 'record' no longer belongs to 'instanceId', after a stall long
+    //enough for another instance to take it over. the slot has to be dropped then, it's someone else's
+    bool renew(TelemetryRecord* record, juce::uint32 instanceId);
+    void release(TelemetryRecord* record, juce::uint32 instanceId);
+    //message thread. whether a monitor has asked for telemetry within StaleAfterMs
+    bool isMonitored() const;
+private:
+    void* base = nullptr;
+    Header* header = nullptr;
+   #if JUCE_WINDOWS
+    void* mappingHandle = nullptr;
+   #endif
+    TelemetryRecord* records = nullptr;
+    void unmap();
+    JUCE_DECLARE_NON_COPYABLE(TelemetrySegment)
+};
+
+/** an instance's writer into the telemetry segment */
+struct TelemetryPublisher : private juce::Timer
+{
+    TelemetryPublisher();
+    ~TelemetryPublisher() override;
+    void prepare(double sampleRate, int maxBlockSize);
+    //audio thread, after processing. no locks, allocation or system calls, the clock is read by the caller
+    void publish(const juce::AudioBuffer<float>& output, int numChannels, double dspSeconds, juce::uint32 bypassMask);
+private:
+    juce::SharedResourcePointer<TelemetrySegment> segment;
+    //claimed on the message thread once a monitor is there, possibly only once a slot frees up after that
+    std::atomic<TelemetryRecord*> record{ nullptr };
+    const juce::uint32 instanceId;
+    double sampleRate = 0.0;
+    juce::uint64 blockCount = 0;
+    //one pole lowpasses at the three split frequencies, the bands are the differences between them
+    std::array<float, TelemetryRecord::NumEnergyBands - 1> splitCoefficients{}, splitStates{};
+    void timerCallback() override;
+};
+#endif
+
 class SimpleEQFromTutorialAudioProcessor  : public juce::AudioProcessor
 {
 public:
@@ -289,14 +735,172 @@ public:
     using BlockType = juce::AudioBuffer<float>;
     SingleChannelSampleFifo<BlockType> leftChannelFifo{ Channel::Left };
     SingleChannelSampleFifo<BlockType> rightChannelFifo{ Channel::Right };
+    //set by the editor while it shows the input spectrum or the EQ delta
+    std::atomic<bool> preEQTapEnabled{ false };
+    //set while an editor is open to read the FIFOs. without one, processBlock doesn't feed them at all
+    std::atomic<bool> analyzerConsumerActive{ false };
+    //spectrum display ballistics. they only change what the editor draws, so they're saved with the state but
+    //aren't parameters a host could automate. the defaults match SpectrumBallisticsSettings
+    std::atomic<float> analyserAveragingMs{ 80.0f }, analyserDecayDbPerSecond{ 36.0f }, analyserPeakHoldMs{ 1500.0f };
+
+    //A/B morphing. the message thread captures the current settings into a snapshot, and while "Morph Enabled"
+    //is on and both are stored the audio thread runs the "Morph" blend of them instead of the band parameters
+    enum Snapshot { SnapshotA, SnapshotB, NumSnapshots };
+    void storeSnapshot(int snapshot);
+    bool hasSnapshot(int snapshot) const;
+    //what's actually being processed, for the response curve
+    ChainSettings getEffectiveChainSettings();
 
 private:
-    MonoChain leftChain, rightChain;
-    void updatePeakFilters(const ChainSettings& chainSettings);
-    void updateLowCutFilters(const ChainSettings& chainSettings);
-    void updateHighCutFilters(const ChainSettings& chainSettings);
+    BandEngine engine;
+    ChainParameterValues chainParameters{ apvts };
+    //main input of the current chunk, copied before the engine runs when the analyzer shows the pre-EQ spectrum
+    BlockType preEQBuffer;
+    std::atomic<float>* analyserEnabled = nullptr;
+    bool wasFeedingAnalyzer = false;
+
+    //one entry per parameter, sorted by id. the binary state is a flat run of these as (id, plain value) records
+    struct StateSlot {
+        juce::uint32 id = 0;
+        juce::RangedAudioParameter* parameter = nullptr;
+        std::atomic<float>* value = nullptr;
+    };
+    std::vector<StateSlot> stateTable;
+    //normalised values being restored, one per stateTable entry. sized with the table so no count can be cut short
+    std::vector<float> restoredState;
+    bool readBinaryState(const void* data, int sizeInBytes);
+
+    //snapshots and their stored flags are guarded by snapshotLock. the audio thread only try-locks it, when
+    //the generation moved, and keeps its own copy in morphEndpoints
+    mutable juce::SpinLock snapshotLock;
+    std::array<ChainSettings, NumSnapshots> snapshots;
+    std::array<bool, NumSnapshots> snapshotStored{};
+    std::atomic<int> snapshotGeneration{ 0 };
+    void setSnapshots(const std::array<ChainSettings, NumSnapshots>& newSnapshots, const std::array<bool, NumSnapshots>& stored);
+
+    std::atomic<float>* morphEnabled = nullptr;
+    std::atomic<float>* morphPosition = nullptr;
+    std::array<ChainSettings, NumSnapshots> morphEndpoints;
+    bool morphEndpointsValid = false;
+    int morphEndpointsGeneration = -1;
+    bool updateMorphedFilters();
+
+    //the settings updateFilters designed from this block, morphed or not. dynamic bands work off their peak gains
+    ChainSettings activeSettings;
+
+   #if SIMPLEEQ_TELEMETRY
+    TelemetryPublisher telemetry;
+   #endif
+
+    //dynamic peak bands re-apply their gain every DynamicSubBlockSize samples, the engine is processed in
+    //sub blocks only while at least one of them is on
+    static constexpr int DynamicSubBlockSize = 16;
+    struct DynamicBandParameters {
+        std::atomic<float>* enabled = nullptr;
+        std::atomic<float>* sidechain = nullptr;
+        std::atomic<float>* threshold = nullptr;
+        std::atomic<float>* ratio = nullptr;
+        std::atomic<float>* attack = nullptr;
+        std::atomic<float>* release = nullptr;
+    };
+    std::array<DynamicBandParameters, MaxPeakBands> dynamicBandParameters;
+    std::array<DynamicBand, MaxPeakBands> dynamicBands;
+    std::array<PeakGainDesigner, MaxPeakBands> peakGainDesigners;
+    std::array<bool, MaxPeakBands> dynamicBandActive{};
+    std::array<bool, MaxPeakBands> dynamicBandUsesSidechain{};
+    //mono detector signals, channel 0 is the main input and channel 1 the sidechain. like preEQBuffer it holds
+    //preparedBlockSize samples, processBlock hands larger host blocks to processChunk in pieces that fit
+    BlockType detectorBuffer;
+    int preparedBlockSize = 0;
+    void processChunk(BlockType& buffer, bool feedAnalyzer, bool tapPreEQ);
+    bool prepareDynamicBands(BlockType& buffer);
+    void applyDynamicGains(int startSample, int numSamples);
+
     void updateFilters();
 
+    //"Auto Gain" follows the designed curve with an output gain, ramped so a change never clicks
+    std::atomic<float>* autoGainEnabled = nullptr;
+    AutoGainCompensation autoGain;
+    juce::SmoothedValue<float, juce::ValueSmoothingTypes::Multiplicative> outputGain{ 1.0f };
+
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SimpleEQFromTutorialAudioProcessor)
 };
+
+#ifndef SIMPLEEQ_HOST_SIMULATION
+ #define SIMPLEEQ_HOST_SIMULATION 0
+#endif
+
+#if SIMPLEEQ_HOST_SIMULATION
+/**
+ headless stand in for a host, to check the processor against its real time deadline. it runs jittered block
+ sizes down to single samples, replays automation on the parameters (bypasses and slopes included), and drains
+ the analyzer FIFOs like an open editor. a callback misses when processing it took longer than the audio it covers.
+ enable with SIMPLEEQ_HOST_SIMULATION=1 and call HostSimulation::run from a console app or a debug hook, Tests/SimpleEqTests.jucer
+ is one. the null tests in here are what a change to the processing or the design code has to pass before it replaces what's there.
+ */
+struct HostSimulation {
+    //one recorded lane, points are (seconds, normalised value) sorted by time and held until the next one
+    struct AutomationLane {
+        juce::String parameterID;
+        std::vector<std::pair<double, float>> points;
+    };
+
+    struct Settings {
+        double sampleRate = 48000.0;
+        int maxBlockSize = 512;
+        double seconds = 10.0;
+        //every 'singleSampleEvery'th callback is a single sample
+        int singleSampleEvery = 16;
+        //used to make random lanes for every parameter when no lanes are given
+        double automationPointsPerSecond = 30.0;
+        juce::int64 seed = 1;
+        std::vector<AutomationLane> lanes;
+    };
+
+    struct Result {
+        int numCallbacks = 0, numMisses = 0;
+        //processing time / block duration
+        double worstLoad = 0.0, averageLoad = 0.0;
+        std::vector<int> blockSizes;
+        std::vector<double> callbackLoads;
+    };
+
+    static Result run(const Settings& settings);
+
+    //cost and accuracy of one low cut slope, run on a BandEngine of its own
+    struct SlopeBenchmark {
+        int decibelsPerOctave = 0;
+        double nanosecondsPerSample = 0.0;
+        //worst distance from the analytic bilinear Butterworth response over probe tones around the cutoff
+        double worstErrorInDecibels = 0.0;
+    };
+    //every Slope at 'cutoff'. the defaults are where single precision sections fall apart first
+    static std::vector<SlopeBenchmark> benchmarkSlopes(double sampleRate = 192000.0, float cutoff = 20.0f);
+
+    //null tests of the band engine against the per section juce::dsp::IIR reference the chains used to run, over
+    //every slope, bypass combination and sample rate, plus the designed magnitudes against the analytic ones
+    struct NullTestSettings {
+        std::vector<double> sampleRates{ 44100.0, 48000.0, 96000.0, 192000.0 };
+        int numSamples = 8192;
+        //a render fails when a sample is further than this from the reference, in dB relative to full scale
+        double maxRenderDeviationInDecibels = -100.0;
+        //a response fails when a point above -100 dB is further than this from the analytic one
+        double maxResponseErrorInDecibels = 0.01;
+    };
+
+    struct NullTestCase {
+        juce::String name;
+        //dBFS of the largest sample difference for renders, largest dB error for responses
+        double worst = -300.0;
+        bool passed = true;
+    };
+
+    struct NullTestResult {
+        std::vector<NullTestCase> renders, responses;
+        bool passed = true;
+    };
+
+    static NullTestResult runNullTests(const NullTestSettings& settings = {});
+};
+#endif
@@ -0,0 +1,98 @@
+/*
+  ==============================================================================
+
+    Console runner for HostSimulation. exits non-zero when a check fails, so
+    it can gate a build.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "../Source/PluginProcessor.h"
+
+namespace {
+    void printLine(const juce::String& text) {
+        std::cout << text << std::endl;
+    }
+
+    //"--name value" or "--name=value", 'fallback' when it's not given
+    double getOption(const juce::ArgumentList& args, const juce::String& name, double fallback) {
+        return args.containsOption(name) ? args.getValueForOption(name).getDoubleValue() : fallback;
+    }
+
+    //wall clock timing depends on the machine and whatever else runs on it, so by default this only reports.
+    //--max-misses and --max-load (average processing time over block duration) gate it on a known machine
+    bool runHostSimulation(const juce::ArgumentList& args) {
+        HostSimulation::Settings settings;
+        settings.sampleRate = getOption(args, "--sample-rate", settings.sampleRate);
+        settings.maxBlockSize = (int)getOption(args, "--block-size", settings.maxBlockSize);
+        settings.seconds = getOption(args, "--seconds", settings.seconds);
+        const auto maxMisses = getOption(args, "--max-misses", std::numeric_limits<double>::infinity());
+        const auto maxLoad = getOption(args, "--max-load", std::numeric_limits<double>::infinity());
+
+        auto result = HostSimulation::run(settings);
+        const auto passed = result.numMisses <= maxMisses && result.averageLoad <= maxLoad;
+
+        auto limit = [](double value, int decimals) {
+            return std::isinf(value) ? juce::String("none") : juce::String(value, decimals);
+        };
+        printLine("host simulation: " + juce::String(result.numCallbacks) + " callbacks, "
+                  + juce::String(result.numMisses) + " misses (limit " + limit(maxMisses, 0) + "), load "
+                  + juce::String(result.averageLoad, 3) + " average (limit " + limit(maxLoad, 3) + "), "
+                  + juce::String(result.worstLoad, 3) + " worst");
+        printLine(passed ? "PASSED" : "FAILED");
+        return passed;
+    }
+
+    //every failing case is listed, the passing ones only counted
+    bool runNullTests() {
+        auto result = HostSimulation::runNullTests();
+
+        auto report = [](const char* kind, const std::vector<HostSimulation::NullTestCase>& cases) {
+            int numFailed = 0;
+            for (const auto& test : cases) {
+                if (!test.passed) {
+                    ++numFailed;
+                    printLine(juce::String("  failed: ") + test.name + ", worst " + juce::String(test.worst, 3));
+                }
+            }
+            printLine(juce::String("null tests: ") + kind + " " + juce::String(cases.size() - numFailed) + "/" + juce::String(cases.size()) + " passed");
+        };
+        report("renders", result.renders);
+        report("responses", result.responses);
+        printLine(result.passed ? "PASSED" : "FAILED");
+        return result.passed;
+    }
+
+    //cost and accuracy per slope. it's a measurement, it only fails when given --max-slope-error in dB
+    bool runSlopeBenchmark(const juce::ArgumentList& args) {
+        const auto maxError = getOption(args, "--max-slope-error", std::numeric_limits<double>::infinity());
+        bool passed = true;
+        printLine("slope benchmark: 192000 Hz, low cut at 20 Hz");
+        for (const auto& benchmark : HostSimulation::benchmarkSlopes()) {
+            passed &= benchmark.worstErrorInDecibels <= maxError;
+            printLine("  " + juce::String(benchmark.decibelsPerOctave) + " dB/oct: "
+                      + juce::String(benchmark.nanosecondsPerSample, 2) + " ns/sample, worst error "
+                      + juce::String(benchmark.worstErrorInDecibels, 4) + " dB");
+        }
+        printLine(passed ? "PASSED" : "FAILED");
+        return passed;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    juce::ArgumentList args(argc, argv);
+    if (args.containsOption("--help|-h")) {
+        printLine("usage: " + args.executableName + " [--sample-rate hz] [--block-size samples] [--seconds s]");
+        printLine("       [--max-misses n] [--max-load fraction] [--max-slope-error dB]");
+        return 0;
+    }
+
+    //the processor's parameters and timers expect a message manager
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    auto passed = runHostSimulation(args);
+    passed &= runNullTests();
+    passed &= runSlopeBenchmark(args);
+    return passed ? 0 : 1;
+}